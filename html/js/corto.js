@@ -831,6 +831,10 @@ function CortoDecoder(data, byteOffset, byteLength) {
 //TODO move this vars into an array.
 	t.geometry.nvert = t.nvert = t.stream.readInt();
 	t.geometry.nface = t.nface = t.stream.readInt();
+
+	//version 2: offset and length of index and attributes streams, not needed decoding sequentially.
+	if(version > 1)
+		t.stream.readArray(8*(n + 1));
 };
 
 CortoDecoder.prototype = {
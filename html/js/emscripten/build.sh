@@ -8,11 +8,12 @@ emcc -std=c++11 emcorto.cpp \
 ../../../src/bitstream.cpp \
 ../../../src/tunstall.cpp \
 ../../../src/normal_attribute.cpp \
+../../../src/simd.cpp \
 ../../../src/color_attribute.cpp \
 ../../../src/decoder.cpp \
 -I../../../include/corto \
 -fno-exceptions \
--O2 -DNDEBUG -DNO_EXCEPTIONS \
+-O2 -DNDEBUG -DNO_EXCEPTIONS -DNO_THREADS \
 -sDISABLE_EXCEPTION_CATCHING \
 --no-entry \
 -s EXPORTED_FUNCTIONS='["_ngroups", "_groups", "_nvert", "_nface", "_decode", "_malloc", "_free", "_sbrk"]' \
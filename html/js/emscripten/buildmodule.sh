@@ -5,10 +5,11 @@ emcc -std=c++11 emcorto.cpp \
 ../../src/bitstream.cpp \
 ../../src/tunstall.cpp \
 ../../src/normal_attribute.cpp \
+../../src/simd.cpp \
 ../../src/color_attribute.cpp \
 ../../src/decoder.cpp \
 -o emcorto.html --post-js post.js \
--O3 \
+-O3 -DNO_THREADS \
 -s "EXTRA_EXPORTED_RUNTIME_METHODS=['ccall']" \
 --memory-init-file 0 \
 -s DISABLE_EXCEPTION_CATCHING=1 \
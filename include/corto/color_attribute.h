@@ -43,6 +43,15 @@ public:
 
 	virtual void quantize(uint32_t nvert, const char *buffer);
 	virtual void dequantize(uint32_t nvert);
+	//average in rgb: chroma wraps around.
+	virtual void merge(const uint32_t *vertices, uint32_t n);
+	//n colors of N components to rgba, scaled by qc.
+	void toRGB(const uchar *c, Color4b *rgb, uint32_t n);
+	//write out_components per color, UINT8 or FLOAT.
+	void store(const Color4b *rgb, uint32_t n, char *out);
+	virtual void deltaDequantize(uint32_t nvert, std::vector<Face> &context) {
+		VertexAttribute::deltaDequantize(nvert, context);
+	}
 
 	virtual void encode(uint32_t nvert, OutStream &stream) {
 		stream.restart();
@@ -52,10 +61,22 @@ public:
 		stream.encodeValues<char>(nvert, (char *)diffs.data(), N);
 		size = stream.elapsed();
 	}
-	virtual void decode(uint32_t /*nvert*/, InStream &stream) {
+	virtual void decode(uint32_t nvert, InStream &stream) {
 		for(int c = 0; c < N; c++)
 			qc[c] = stream.readUint8();
-		stream.decodeValues<uchar>((uchar *)buffer, N);
+		if(!inplace())
+			values.resize(nvert*N);
+		stream.decodeValues<uchar>(quantized(), N, nvert);
+	}
+	//packed output is converted in place (also from 3 to 4 components), unless it is smaller than the quantized colors.
+	virtual bool inplace() {
+		uint32_t bytes = out_components*(uint32_t)formatBytes(format);
+		return (!stride || stride == bytes) && bytes >= (uint32_t)N;
+	}
+	virtual bool skip(InStream &stream) {
+		stream.readArray<uchar>(N); //qc
+		stream.skipValues(N);
+		return true;
 	}
 };
 
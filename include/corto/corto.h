@@ -3,5 +3,6 @@
 
 #include "encoder.h"
 #include "decoder.h"
+#include "tiles.h"
 
 #endif // CORTO_H
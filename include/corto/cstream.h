@@ -20,9 +20,11 @@ If not, see <http://www.gnu.org/licenses/>.
 #define CRT_CSTREAM_H
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <algorithm>
 
 #include "bitstream.h"
 
@@ -39,22 +41,78 @@ public:
 	Stream(): entropy(TUNSTALL) {}
 };
 
+//destination of the bytes of an OutStream, written while encoding.
+class OutSink {
+public:
+	bool failed; //some write failed.
+
+	OutSink(): failed(false) {}
+	virtual ~OutSink() {}
+	//append bytes.
+	virtual void write(const uchar *data, size_t size) = 0;
+	//overwrite bytes already written (header fields known only at the end): the sink must be seekable.
+	virtual void rewrite(size_t offset, const uchar *data, size_t size) = 0;
+};
+
+//buffered writes to a FILE opened for writing, offsets are relative to its position when the sink is created.
+class FileSink: public OutSink {
+public:
+	FileSink(FILE *file);
+	virtual void write(const uchar *data, size_t size);
+	virtual void rewrite(size_t offset, const uchar *data, size_t size);
+
+private:
+	FILE *file;
+	int64_t start;
+	size_t length;
+};
+
 class OutStream: public Stream {
 protected:
-	std::vector<uchar> buffer;
+	std::vector<uchar> buffer; //the whole stream, or the bytes not yet flushed to the sink.
+	OutSink *sink;
+	size_t flushed;    //bytes written to the sink.
+	size_t flush_size; //the buffer is flushed when it grows larger.
 	size_t stopwatch; //used to measure stream partial size.
+	//alignment padding written (offset and bytes), so that the stream can be appended at any offset.
+	//Cleared on flush: only streams without a sink can be appended.
+	std::vector<std::pair<size_t, size_t> > pads;
 
 public:
-	OutStream(size_t r = 0): stopwatch(0) { buffer.reserve(r); }
-	uint32_t size() { return buffer.size(); }
+	int threads; //used to compress the components of encodeValues in parallel.
+
+	OutStream(size_t r = 0): sink(nullptr), flushed(0), flush_size(0), stopwatch(0), threads(1) { buffer.reserve(r); }
+	//write the stream to the sink while encoding instead of keeping it all in memory,
+	//set it before writing: data() then returns only the bytes not yet flushed.
+	void setSink(OutSink *s, size_t _flush_size = 1<<24) {
+		sink = s;
+		flush_size = _flush_size;
+		buffer.reserve(flush_size);
+	}
+	//write the buffer to the sink (Encoder::encode calls it at the end).
+	void flush();
+
+	size_t size() { return flushed + buffer.size(); }
+	//offsets in the format are 32 bit: larger streams can't be addressed.
+	static uint32_t offset32(size_t offset) {
+#ifndef NO_EXCEPTIONS
+		if(offset > 0xffffffffull)
+			throw "Stream larger than 4GB.";
+#endif
+		return (uint32_t)offset;
+	}
 	uchar *data() { return buffer.data(); }
-	void reserve(size_t r) { buffer.reserve(r); }
-	void restart() { stopwatch = buffer.size(); }
+	void reserve(size_t r) { buffer.reserve(sink? std::min(r, flush_size) : r); }
+	void restart() { stopwatch = size(); }
 	uint32_t elapsed() {
 		size_t e = size() - stopwatch; stopwatch = size();
 		return (uint32_t)e;
 	}
 	int  compress(uint32_t size, uchar *data);
+	//compress each array in its own stream (on worker threads) and append them in order.
+	void compress(std::vector<std::vector<uchar> > &arrays);
+	//append a stream encoded on its own (without a sink), padding is recomputed for the new offset.
+	void append(OutStream &stream);
 	int  tunstall_compress(unsigned char *data, int size);
 
 #ifdef ENTROPY_TESTS
@@ -69,6 +127,11 @@ public:
 	template<class T> void writeArray(int count, T *c) {
 		push(c, count*sizeof(T));
 	}
+	//overwrite a value already written (for header fields known only at the end).
+	template<class T> void rewrite(size_t offset, T c) {
+		rewrite(offset, (const uchar *)&c, sizeof(T));
+	}
+	void rewrite(size_t offset, const uchar *data, size_t s);
 
 	void writeString(const char *str) {
 		uint16_t bytes = (uint16_t)(strlen(str)+1);
@@ -79,16 +142,22 @@ public:
 	void write(BitStream &stream) {
 		stream.flush();
 		write<int>((int)stream.size);
+		align();
+		push(stream.buffer, stream.size*sizeof(uint32_t));
+	}
 
-		//padding to 32 bit is needed for javascript reading (which uses int words.), mem needs to be aligned.
-		int pad = size() & 0x3;
+	//padding to 32 bit is needed for javascript reading (which uses int words.), mem needs to be aligned.
+	void align() {
+		size_t pad = size() & 0x3;
 		if(pad != 0)
 			pad = 4 - pad;
+		pads.push_back(std::make_pair(size(), pad));
 		grow(pad);
-		push(stream.buffer, stream.size*sizeof(uint32_t));
 	}
 
 	uchar *grow(size_t s) {
+		if(sink && buffer.size() + s > flush_size)
+			flush();
 		size_t len = buffer.size();
 		buffer.resize(len + s);
 		//padding to 32 bit is needed for javascript reading (which uses int words.), mem needs to be aligned.
@@ -97,6 +166,12 @@ public:
 	}
 
 	void push(const void *b, size_t s) {
+		if(sink && s >= flush_size) { //large arrays go straight to the sink.
+			flush();
+			sink->write((const uchar *)b, s);
+			flushed += s;
+			return;
+		}
 		uchar *pos = grow(s);
 		memcpy(pos, b, s);
 	}
@@ -136,8 +211,7 @@ public:
 		}
 
 		write(bitstream);
-		for(int c = 0; c < N; c++)
-			compress((uint32_t)clogs[c].size(), clogs[c].data());
+		compress(clogs);
 	}
 	//encode differences of vectors (assuming correlation between components)
 	template <class T> void encodeArray(uint32_t size, T *values, int N) {
@@ -211,24 +285,27 @@ protected:
 public:
 
 	InStream(): buffer(NULL), pos(NULL) {}
-	InStream(int _size, uchar *_buffer) {
+	InStream(size_t _size, uchar *_buffer) {
 		init(_size, _buffer);
 	}
 
 	void decompress(std::vector<uchar> &data);
 	void tunstall_decompress(std::vector<uchar> &data);
+	//move past a compressed block without decompressing it.
+	void skipCompressed();
 
 #ifdef ENTROPY_TESTS
 	int  zlib_compress(uchar *data, int size);
 	int  lz4_compress(uchar *data, int size);
 #endif
 
-	void init(int /*_size*/, const uchar *_buffer) {
+	void init(size_t /*_size*/, const uchar *_buffer) {
 		buffer = _buffer; //I'm not lying, I won't touch it.
 		pos = buffer;
 	}
 
 	void rewind() { pos = buffer; }
+	void seek(size_t offset) { pos = buffer + offset; }
 
 /*	template<class T> T read() {
 		T c;
@@ -282,7 +359,7 @@ public:
 
 	void read(BitStream &stream) {
 		int s = readUint32();
-		//padding to 32 bit is needed for javascript reading (which uses int words.), mem needs to be aligned.
+		//padding to 32 bit is needed for javascript reading (which uses int words.), BitStream reads unaligned words.
 		int pad = (pos - buffer) & 0x3;
 		if(pad != 0)
 			pos += 4 - pad;
@@ -291,7 +368,18 @@ public:
 	}
 
 
-	template <class T> int decodeValues(T *values, int N) {
+	//skip streams written by encodeValues and encodeArray (encodeDiffs and encodeIndices too).
+	void skipValues(int N) {
+		BitStream bitstream;
+		read(bitstream);
+		for(int c = 0; c < N; c++)
+			skipCompressed();
+	}
+
+	void skipArray() { skipValues(1); }
+
+	//at most limit values are written, the stream is consumed anyway.
+	template <class T> int decodeValues(T *values, int N, uint32_t limit = 0xffffffff) {
 		BitStream bitstream;
 		read(bitstream);
 
@@ -301,7 +389,8 @@ public:
 			decompress(logs);
 			if(!values) continue;
 
-			for(uint32_t i = 0; i < logs.size(); i++) {
+			uint32_t size = std::min<uint32_t>((uint32_t)logs.size(), limit);
+			for(uint32_t i = 0; i < size; i++) {
 				uchar &diff = logs[i];
 				if(diff == 0) {
 					values[i*N + c] = 0;
@@ -314,6 +403,12 @@ public:
 					val = -val -middle;
 				values[i*N + c] = (T)val;
 			}
+			if(c == N-1)
+				break;
+			//the next component bits follow the ones left out.
+			for(uint32_t i = size; i < logs.size(); i++)
+				if(logs[i])
+					bitstream.read(logs[i]);
 		}
 		return logs.size();
 	}
@@ -321,12 +416,15 @@ public:
 
 
 
-	template <class T> uint32_t decodeArray(T *values, int N) {
+	//at most limit values are written and counted.
+	template <class T> uint32_t decodeArray(T *values, int N, uint32_t limit = 0xffffffff) {
 		BitStream bitstream;
 		read(bitstream);
 
 		std::vector<uchar> logs;
 		decompress(logs);
+		if(logs.size() > limit)
+			logs.resize(limit);
 
 		if(!values) //just skip and return number of readed
 			return (uint32_t)logs.size();
@@ -30,6 +30,7 @@ If not, see <http://www.gnu.org/licenses/>.
 #include "vertex_attribute.h"
 #include "color_attribute.h"
 #include "normal_attribute.h"
+#include "mappedfile.h"
 
 namespace crt {
 
@@ -43,7 +44,16 @@ public:
 	std::map<std::string, VertexAttribute *> data;
 	IndexAttribute index;
 
-	Decoder(int len, const uchar *input);
+	//reconstruct parallelogram and delta predicted attributes while decoding connectivity:
+	//saves the index.prediction array and one pass over the attributes.
+	bool fuse_prediction;
+	//threads used to entropy decode attributes concurrently with connectivity and to estimate normals (1 is serial).
+	int threads;
+
+	//input needs no alignment and is not copied: it must outlive the decoder.
+	Decoder(size_t len, const uchar *input);
+	//memory maps the file for the lifetime of the decoder.
+	Decoder(const char *filename);
 	~Decoder();
 
 	bool hasAttr(const char *name) { return data.count(name); }
@@ -52,24 +62,49 @@ public:
 	bool setNormals(float *buffer)   { return setAttribute("normal", (char *)buffer, VertexAttribute::FLOAT); }
 	bool setNormals(int16_t *buffer) { return setAttribute("normal", (char *)buffer, VertexAttribute::INT16); }
 	bool setUvs(float *buffer)       { return setAttribute("uv", (char *)buffer, VertexAttribute::FLOAT); }	
+	//HALF, SNORM16, UNORM16, SNORM8 (or any other format): normalized positions and uvs
+	//after decode are relative to data[name]->offset and scale.
+	bool setPositions(void *buffer, VertexAttribute::Format format) { return setAttribute("position", (char *)buffer, format); }
+	bool setNormals(void *buffer, VertexAttribute::Format format)   { return setAttribute("normal", (char *)buffer, format); }
+	bool setUvs(void *buffer, VertexAttribute::Format format)       { return setAttribute("uv", (char *)buffer, format); }
 	bool setColors(uchar *buffer, int components = 4); 
 	
 	bool setAttribute(const char *name, char *buffer, VertexAttribute::Format format);
+	//interleaved vertex buffer: vertex i is written at base + offset + i*stride (in bytes).
+	bool setAttribute(const char *name, char *base, VertexAttribute::Format format, uint32_t stride, uint32_t offset);
+	bool setColors(uchar *base, int components, uint32_t stride, uint32_t offset);
 	bool setAttribute(const char *name, char *buffer, VertexAttribute *attr);
 
 	void setIndex(uint32_t *buffer) { index.faces32 = buffer; }
-	void setIndex(uint16_t *buffer) { index.faces16 = buffer; }
+	//group_base: indices of each group are relative to index.groups[i].base, so that meshes
+	//with more than 64K vertices can use 16 bit indices if no group spans more than 64K vertices.
+	void setIndex(uint16_t *buffer, bool group_base = false) { index.faces16 = buffer; index.group_base = group_base; }
+
+	//progressive point clouds (Encoder::progressive) have a group per octree level: decode only
+	//the first levels (0 for all), call it before setting the buffers: returns the vertices to allocate.
+	uint32_t setLevels(uint32_t levels);
 
 	void decode();
 
 private:
+	MappedFile file;
 	InStream stream;
+	uint32_t version;
+
+	struct Substream {
+		uint32_t offset, length; //in bytes from the beginning of the stream.
+	};
+	std::vector<Substream> substreams; //index, then attributes (from version 2).
 
 	uint32_t vertex_count; //keep tracks of current decoding vertex
 
+	void init(size_t len, const uchar *input);
+	bool locateStreams(std::vector<VertexAttribute *> &attrs, std::vector<InStream> &streams);
+	void decodeAttributes();
 	void decodePointCloud();
 	void decodeMesh();
-	void decodeFaces(uint32_t start, uint32_t end, uint32_t &cler);
+	template <class Predictor> void decodeConnectivity(Predictor &predict);
+	template <class Output, class Predictor> void decodeFaces(uint32_t start, uint32_t end, uint32_t &cler, Output &out, Predictor &predict);
 };
 
 
@@ -44,6 +44,21 @@ public:
 
 	std::map<std::string, VertexAttribute *> data;
 	int header_size;
+	uint32_t version; //1 (default) is readable by older decoders, 2 adds the table of substreams offsets.
+	//threads used to quantize, estimate normals and compute the prediction diffs (1 is serial),
+	//set it before adding the attributes. The stream does not depend on it.
+	int threads;
+	//point clouds: order points by octree level, coarse to fine. Groups record where each level ends,
+	//so that decoding only the first levels (Decoder::setLevels) gives a uniformly subsampled cloud.
+	bool progressive;
+	//point clouds: points with the same quantized position are encoded once, with the attributes of the
+	//first one (in input order) or their average (custom attributes keep the first).
+	enum Merge { NO_MERGE = 0, MERGE_FIRST, MERGE_AVERAGE };
+	Merge merge;
+	//after encoding a point cloud: remap[i] is the decoded position of input vertex i (merged points share it),
+	//merged is the number of points removed.
+	std::vector<uint32_t> remap;
+	uint32_t merged;
 
 	OutStream stream;
 
@@ -90,6 +105,7 @@ private:
 	std::vector<Quad> prediction;
 
 	void encodePointCloud();
+	void encodeStreams();
 
 	void encodeMesh();
 	void encodeFaces(int start, int end);
@@ -39,16 +39,18 @@ struct Face {
 
 struct Group {
 	uint32_t end; //1+ last face
+	uint32_t base; //lowest vertex referenced, 16 bit indices per group are relative to it.
 	std::map<std::string, std::string> properties;
 
-	Group() {}
-	Group(uint32_t e): end(e) {}
+	Group(): base(0) {}
+	Group(uint32_t e): end(e), base(0) {}
 };
 
 class IndexAttribute {
 public:
 	uint32_t *faces32;
 	uint16_t *faces16;
+	bool group_base; //faces16 indices are relative to the base of each group (for meshes above 64K vertices).
 	std::vector<uint32_t> faces;
 	std::vector<Face> prediction;
 
@@ -58,7 +60,7 @@ public:
 	uint32_t max_front; //max size reached by front.
 	uint32_t size;
 
-	IndexAttribute(): faces32(nullptr), faces16(nullptr), max_front(0) {}
+	IndexAttribute(): faces32(nullptr), faces16(nullptr), group_base(false), max_front(0) {}
 	void encode(OutStream &stream) {
 		stream.write<uint32_t>(max_front);
 
@@ -86,6 +88,25 @@ public:
 		stream.read(bitstream);
 	}
 
+	void skip(InStream &stream) {
+		stream.readUint32(); //max_front
+		stream.skipCompressed();
+		BitStream skipped;
+		stream.read(skipped);
+	}
+
+	//call f(faces, nface, base) once per group with the right index type, instead of branching per face.
+	template <class F> void visitGroups(F &f) {
+		uint32_t start = 0;
+		for(Group &g: groups) {
+			if(faces16)
+				f(faces16 + start*3, g.end - start, group_base ? g.base : 0);
+			else
+				f(faces32 + start*3, g.end - start, 0);
+			start = g.end;
+		}
+	}
+
 	void decodeGroups(InStream &stream) {
 		groups.resize(stream.readUint32());
 		for(Group &g: groups) {
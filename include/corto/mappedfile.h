@@ -0,0 +1,85 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRT_MAPPEDFILE_H
+#define CRT_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cstream.h"
+
+namespace crt {
+
+//read only memory map of a whole file.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	//false if the file can't be opened or is empty.
+	bool open(const char *filename);
+	void close();
+
+	const unsigned char *data() const { return buffer; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char *buffer;
+	size_t length;
+#ifdef _WIN32
+	void *file, *mapping;
+#else
+	int fd;
+#endif
+};
+
+//writes an OutStream into a memory mapped file, the file grows as needed.
+class MappedSink: public OutSink {
+public:
+	MappedSink();
+	~MappedSink() { close(); }
+	MappedSink(const MappedSink &) = delete;
+	MappedSink &operator=(const MappedSink &) = delete;
+
+	//creates or truncates the file.
+	bool open(const char *filename);
+	//unmaps and truncates the file to the bytes written.
+	void close();
+
+	virtual void write(const uchar *data, size_t size);
+	virtual void rewrite(size_t offset, const uchar *data, size_t size);
+
+private:
+	unsigned char *buffer;
+	size_t length;   //written
+	size_t capacity; //mapped
+#ifdef _WIN32
+	void *file, *mapping;
+#else
+	int fd;
+#endif
+	bool reserve(size_t size);
+	void unmap();
+};
+
+} //namespace
+
+#endif // CRT_MAPPEDFILE_H
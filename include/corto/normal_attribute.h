@@ -58,16 +58,31 @@ public:
 	virtual void quantize(uint32_t nvert, const char *buffer);
 	virtual void preDelta(uint32_t nvert,  uint32_t nface, std::map<std::string, VertexAttribute *> &attrs, IndexAttribute &index);
 	virtual void deltaEncode(std::vector<Quad> &context);
+	//average on the sphere.
+	virtual void merge(const uint32_t *vertices, uint32_t n);
 	virtual void encode(uint32_t nvert, OutStream &stream);
 
 	virtual void decode(uint32_t nvert, InStream &stream);
+	virtual bool skip(InStream &stream);
 	virtual void deltaDecode(uint32_t nvert, std::vector<Face> &context);
 	virtual void postDelta(uint32_t nvert,  uint32_t nface, std::map<std::string, VertexAttribute *> &attrs, IndexAttribute &index);
 	virtual void dequantize(uint32_t nvert);
 
-	//Normal estimation
-	void computeNormals(Point3s *normals, std::vector<Point3f> &estimated);
-	void computeNormals(Point3f *normals, std::vector<Point3f> &estimated);
+	//sum of the (not normalized) normals of the faces around each vertex, used by the ESTIMATED and BORDER predictions.
+	//Threads own ranges of vertices, each vertex adds its faces in order: the result does not depend on threads.
+	static void estimateNormals(uint32_t nvert, const Point3f *coords, uint32_t nface, const uint32_t *index, Point3f *normals, int threads = 1);
+
+	//Normal estimation, vertices [start, end) to normals[0...], count is the number of diffs used so far.
+	void computeNormals(Point3s *normals, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count);
+	void computeNormals(Point3f *normals, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count);
+	//octahedral output: estimated octahedral plus the diff.
+	void computeNormals(Point2i *octa, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count);
+	void computeNormals(Point2s *octa, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count);
+	//OCTA16 and OCTA32 output 2 components, offset and scale map them to [-1, 1].
+	int outComponents();
+	void octaRange();
+	//write SNORM8 or HALF output.
+	void store(const Point3f *normals, uint32_t nvert, char *out);
 
 
 	//Conversion to Octahedron encoding.
@@ -0,0 +1,60 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received 
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRT_SIMD_H
+#define CRT_SIMD_H
+
+#include <stdint.h>
+#include "point.h"
+
+/* Vectorized inner loops of quantization and dequantization.
+ * Each kernel produces exactly the same bits as the scalar code it replaces,
+ * the instruction set (AVX2, SSE2 or NEON) is chosen at runtime.
+ * Compile with NO_SIMD to use only the plain C++ loops. */
+
+namespace crt {
+
+class Simd {
+public:
+	enum Level { SCALAR = 0, SSE2, AVX2, NEON };
+
+	//detected at startup, can be lowered to compare against the scalar path.
+	static Level level;
+	static Level detect();
+
+	//out[i] = in[i]*q, in and out can be the same buffer.
+	static void scale(const int32_t *in, float *out, uint32_t n, float q);
+	//inplace Color4b::toRGB on 4 components colors, each component multiplied by qc.
+	static void toRGB(uchar *colors, uint32_t n, const int *qc);
+	//inplace Color4b::toYCC on 4 components colors, each component divided by qc first.
+	static void toYCC(uchar *colors, uint32_t n, const int *qc);
+	//8 bit normalized to float: out[i] = in[i]/255.0f.
+	static void toFloat(const uchar *in, float *out, uint32_t n);
+	//octahedral pairs to unit vectors, same as NormalAttr::toSphere.
+	static void toSphere(const int32_t *octa, Point3f *normals, uint32_t n, int unit);
+	static void toSphere(const int32_t *octa, Point3s *normals, uint32_t n, int unit);
+	//unit vectors (or estimated normals) to octahedral pairs, same as NormalAttr::toOcta.
+	static void toOcta(const Point3f *normals, int32_t *octa, uint32_t n, int unit);
+	//running sum of n rows of N components (point clouds delta decoding): each row adds the previous one,
+	//sum holds the row before the first and is updated to the last one.
+	static void prefixSum(int32_t *values, uint32_t n, int N, int32_t *sum);
+};
+
+} //namespace
+
+#endif // CRT_SIMD_H
@@ -0,0 +1,124 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRT_TILES_H
+#define CRT_TILES_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <functional>
+
+#include "encoder.h"
+#include "decoder.h"
+
+namespace crt {
+
+/* Tiled point clouds: points are bucketed in octree cells (morton prefixes) and each cell is encoded
+   as an independent point cloud stream.
+   Layout: magic, version, number of tiles, the table of tiles, then the tiles (aligned to 4 bytes). */
+
+struct Tile {
+	Point3f min, max; //bounding box of the points.
+	uint32_t nvert;
+	uint32_t offset, length; //in bytes from the beginning of the stream.
+};
+
+class TileEncoder {
+public:
+	uint32_t nvert;
+	uint32_t max_points; //cells with more points are split.
+	//tiles are encoded concurrently on worker threads (1 is serial).
+	int threads;
+	Stream::Entropy entropy;
+	std::map<std::string, std::string> exif; //copied into each tile.
+
+	std::vector<Tile> tiles;
+	OutStream stream;
+
+	TileEncoder(uint32_t _nvert, uint32_t _max_points = 1<<16, Stream::Entropy entropy = Stream::TUNSTALL);
+
+	//same as the Encoder ones, quantization steps are computed on the whole cloud: all tiles share the same grid.
+	bool addPositions(const float *buffer, float q = 0.0f);
+	bool addPositionsBits(const float *buffer, int bits);
+	bool addNormals(const float *buffer, int bits);
+	bool addColors(const unsigned char *buffer, int rbits = 6, int gbits = 7, int bbits = 6, int abits = 5);
+	bool addColors3(const unsigned char *buffer, int rbits = 6, int gbits = 7, int bbits = 6);
+	bool addUvs(const float *buffer, float q);
+	bool addAttribute(const char *name, const char *buffer, VertexAttribute::Format format, int components, float q, uint32_t strategy = 0);
+
+	void encode();
+
+private:
+	const float *positions;
+	float q;
+
+	struct Input {
+		const char *buffer;
+		uint32_t bytes; //per vertex
+		std::function<bool(Encoder &, const char *)> add; //gathered values of the tile.
+	};
+	std::vector<Input> inputs;
+
+	void split(std::vector<std::pair<uint32_t, uint32_t> > &cells, const std::vector<ZPoint> &zpoints, uint32_t start, uint32_t end, int shift);
+};
+
+class TileDecoder {
+public:
+	std::vector<Tile> tiles;
+	std::vector<uint32_t> selected; //tiles to be decoded, all of them unless select is called.
+	uint32_t nvert;                 //in the selected tiles.
+	//selected tiles are decoded concurrently on worker threads (1 is serial).
+	int threads;
+
+	TileDecoder(size_t len, const uchar *input);
+
+	bool hasAttr(const char *name) { return attributes.count(name) != 0; }
+
+	//select the tiles intersecting the box: returns the vertices to allocate.
+	//Tiles are decoded whole, points outside the box are not filtered.
+	uint32_t select(const Point3f &min, const Point3f &max);
+
+	bool setPositions(float *buffer) { return setAttribute("position", (char *)buffer, VertexAttribute::FLOAT, 12); }
+	bool setNormals(float *buffer)   { return setAttribute("normal", (char *)buffer, VertexAttribute::FLOAT, 12); }
+	bool setUvs(float *buffer)       { return setAttribute("uv", (char *)buffer, VertexAttribute::FLOAT, 8); }
+	bool setColors(uchar *buffer, int components = 4) { return setColors(buffer, components, components, 0); }
+	//vertex i of the selection is written at base + offset + i*stride (in bytes), stride 0 means packed rows.
+	bool setAttribute(const char *name, char *base, VertexAttribute::Format format, uint32_t stride, uint32_t offset = 0);
+	bool setColors(uchar *base, int components, uint32_t stride, uint32_t offset);
+
+	//selected tiles are written one after the other, in the order of selected.
+	void decode();
+
+private:
+	const uchar *input;
+	std::map<std::string, int> attributes; //of the tiles, with their number of components.
+
+	struct Output {
+		std::string name;
+		char *base;
+		VertexAttribute::Format format;
+		uint32_t stride, offset;
+		int components; //colors only
+	};
+	std::vector<Output> outputs;
+};
+
+} //namespace
+
+#endif // CRT_TILES_H
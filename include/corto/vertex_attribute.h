@@ -22,18 +22,65 @@ If not, see <http://www.gnu.org/licenses/>.
 #include <map>
 #include <string>
  #include <algorithm>
+#include <math.h>
+#include <string.h>
 #include "cstream.h"
 #include "index_attribute.h"
+#include "simd.h"
+#include "workers.h"
 
 namespace crt {
 
+//running sum of n rows of N components, sum holds the row before the first: int32 rows are vectorized.
+inline void scanRows(int32_t *values, uint32_t n, int N, int32_t *sum) { Simd::prefixSum(values, n, N, sum); }
+template <class T> void scanRows(T *values, uint32_t n, int N, T *sum) {
+	for(T *v = values, *end = values + (size_t)n*N; v < end; v += N)
+		for(int c = 0; c < N; c++)
+			v[c] = sum[c] += v[c];
+}
+
+//point clouds delta decoding, row i += row i-1: each range of rows is summed on its own,
+//then scanned starting from the total of the ranges before it.
+//done(start, end) is called on each block of rows as soon as it is final, while still in cache.
+template <class T, class F> void prefixSum(T *values, uint32_t n, int N, int threads, F done) {
+	std::vector<uint32_t> bounds = splitRanges(n, threads, 1<<16);
+	size_t nranges = bounds.size() - 1;
+	std::vector<T> sums((nranges + 1)*N, 0); //sums[t*N] is the row before range t.
+	if(nranges > 1) {
+		forRanges(bounds, [&](size_t t) {
+			T *sum = &sums[(t + 1)*N];
+			for(const T *v = values + (size_t)bounds[t]*N, *end = values + (size_t)bounds[t + 1]*N; v < end; v += N)
+				for(int c = 0; c < N; c++)
+					sum[c] += v[c];
+		});
+		for(size_t t = 1; t <= nranges; t++)
+			for(int c = 0; c < N; c++)
+				sums[t*N + c] += sums[(t - 1)*N + c];
+	}
+	forRanges(bounds, [&](size_t t) {
+		const uint32_t block = 1024;
+		for(uint32_t start = bounds[t]; start < bounds[t + 1]; start += block) {
+			uint32_t end = std::min(start + block, bounds[t + 1]);
+			scanRows(values + (size_t)start*N, end - start, N, &sums[t*N]);
+			done(start, end);
+		}
+	});
+}
+
+template <class T> void prefixSum(T *values, uint32_t n, int N, int threads) {
+	prefixSum(values, n, N, threads, [](uint32_t, uint32_t) {});
+}
+
 class VertexAttribute {
 public:
-	enum Format { UINT32 = 0, INT32, UINT16, INT16, UINT8, INT8, FLOAT, DOUBLE };
+	enum Format { UINT32 = 0, INT32, UINT16, INT16, UINT8, INT8, FLOAT, DOUBLE,
+				  HALF, SNORM16, UNORM16, SNORM8,   //output only
+				  OCTA16, OCTA32 };                 //octahedral normals output, 2 components
 	enum Strategy { PARALLEL = 0x1, CORRELATED = 0x2 };
 	enum CODEC { GENERIC_CODEC = 1, NORMAL_CODEC = 2, COLOR_CODEC = 3, CUSTOM_CODEC = 100 };
 
 	char *buffer;     //output data buffer, input is not needed
+	uint32_t stride;  //bytes between vertices in the output buffer, 0 if packed.
 	int N;            //number of components
 	float q;          //quantization step
 	int strategy;
@@ -41,10 +88,51 @@ public:
 	Format format;    //input or output format
 	uint32_t size;    //compressed size (for stats and other nefarious purpouses)
 	int bits;         //quantization in bits;
+	int threads;      //used by quantization and prediction loops, set by encoder and decoder.
+
+	//normalized output (SNORM16, UNORM16, SNORM8) of generic attributes is: offset + scale*normalized,
+	//one per component, computed by dequantize.
+	std::vector<float> offset, scale;
 
-	VertexAttribute(): buffer(nullptr), N(0), q(0.0f), strategy(0), format(INT32), size(0) {}
+	VertexAttribute(): buffer(nullptr), stride(0), N(0), q(0.0f), strategy(0), format(INT32), size(0), threads(1) {}
 	virtual ~VertexAttribute() {}
 
+	static int formatBytes(Format format) {
+		switch(format) {
+		case UINT8: case INT8: case SNORM8: return 1;
+		case UINT16: case INT16: case HALF: case SNORM16: case UNORM16: case OCTA16: return 2;
+		case DOUBLE: return 8;
+		default: return 4;
+		}
+	}
+
+	//round to nearest even, overflow to infinity.
+	static uint16_t toHalf(float f) {
+		uint32_t x;
+		memcpy(&x, &f, 4);
+		uint16_t sign = (x >> 16) & 0x8000;
+		uint32_t m = x & 0x7fffff;
+		int e = (int)((x >> 23) & 0xff) - 127 + 15;
+		if(e == 128 + 15)  //inf and nan
+			return sign | 0x7c00 | (m? 0x200 : 0);
+		if(e >= 31)
+			return sign | 0x7c00;
+		uint32_t shift = 13;
+		if(e <= 0) { //denormalized
+			if(e < -10)
+				return sign;
+			m |= 0x800000;
+			shift = 14 - e;
+			e = 0;
+		}
+		uint32_t h = ((uint32_t)e << 10) + (m >> shift);
+		uint32_t rest = m & ((1u << shift) - 1);
+		uint32_t half = 1u << (shift - 1);
+		if(rest > half || (rest == half && (h & 1)))
+			h++; //might carry into the exponent, which is correct.
+		return sign | h;
+	}
+
 	virtual int codec() = 0; //identifies attribute class.
 
 	//quantize and store as values
@@ -53,17 +141,27 @@ public:
 	virtual void preDelta(uint32_t /*nvert*/, uint32_t /*nface*/, std::map<std::string, VertexAttribute *> &/*attrs*/, IndexAttribute &/*index*/) {}
 	//use parallelogram prediction or just diff from v0
 	virtual void deltaEncode(std::vector<Quad> &context) = 0;
+	//point clouds duplicated points: the quantized values of vertices[0] become the average of the n vertices.
+	//The default keeps the first values.
+	virtual void merge(const uint32_t * /*vertices*/, uint32_t /*n*/) {}
 	//compress diffs and write to stream
 	virtual void encode(uint32_t nvert, OutStream &stream) = 0;
 
 	//read quantized data from streams
 	virtual void decode(uint32_t nvert, InStream &stream) = 0;
+	//move past the attribute data without decoding, return false if the layout is unknown.
+	virtual bool skip(InStream &/*stream*/) { return false; }
 	//use parallelogram prediction to recover values
 	virtual void deltaDecode(uint32_t nvert, std::vector<Face> &faces) = 0;
 	//use other attributes to estimate (normals for example)
 	virtual void postDelta(uint32_t /*nvert*/, uint32_t /*nface*/, std::map<std::string, VertexAttribute *> &/*attrs*/, IndexAttribute &/*index*/) {}
 	//reverse quantization operations
 	virtual void dequantize(uint32_t nvert) = 0;
+	//deltaDecode and dequantize in one pass, only if no other attribute needs the quantized values.
+	virtual void deltaDequantize(uint32_t nvert, std::vector<Face> &context) {
+		deltaDecode(nvert, context);
+		dequantize(nvert);
+	}
 };
 
 
@@ -81,41 +179,61 @@ public:
 
 		values.resize(n);
 		diffs.resize(n);
-		switch(format) {
-		case INT32:
-			for(uint32_t i = 0; i < n; i++)
-				values[i] = ((const int32_t *)buffer)[i]/q;
-			break;
-		case INT16:
-			for(uint32_t i = 0; i < n; i++)
-				values[i] = ((const int16_t *)buffer)[i]/q;
-			break;
-		case INT8:
-			for(uint32_t i = 0; i < n; i++)
-				values[i] = ((const int8_t *)buffer)[i]/q;
-			break;
-		case FLOAT:
-			for(uint32_t i = 0; i < n; i++)
-				values[i] = ((const float *)buffer)[i]/q;
-			break;
-		case DOUBLE:
-			for(uint32_t i = 0; i < n; i++)
-				values[i] = ((const double *)buffer)[i]/q;
-			break;
-		default:
-#ifndef NO_EXCEPTIONS 
+#ifndef NO_EXCEPTIONS
+		if(format != INT32 && format != INT16 && format != INT8 && format != FLOAT && format != DOUBLE)
 			throw "Unsupported format.";
-#else
-			break;
 #endif
-		}
+		//each range of vertices is quantized and reports min and max per component.
+		std::vector<uint32_t> bounds = splitRanges(nvert, threads);
+		std::vector<int> ranges((bounds.size() - 1)*N*2);
+		forRanges(bounds, [&](size_t t) {
+			uint32_t start = bounds[t]*N;
+			uint32_t end = bounds[t + 1]*N;
+			switch(format) {
+			case INT32:
+				for(uint32_t i = start; i < end; i++)
+					values[i] = ((const int32_t *)buffer)[i]/q;
+				break;
+			case INT16:
+				for(uint32_t i = start; i < end; i++)
+					values[i] = ((const int16_t *)buffer)[i]/q;
+				break;
+			case INT8:
+				for(uint32_t i = start; i < end; i++)
+					values[i] = ((const int8_t *)buffer)[i]/q;
+				break;
+			case FLOAT:
+				for(uint32_t i = start; i < end; i++)
+					values[i] = ((const float *)buffer)[i]/q;
+				break;
+			case DOUBLE:
+				for(uint32_t i = start; i < end; i++)
+					values[i] = ((const double *)buffer)[i]/q;
+				break;
+			default:
+				break;
+			}
+			if(start == end)
+				return;
+			int *min = &ranges[t*N*2];
+			int *max = min + N;
+			for(int k = 0; k < N; k++) {
+				min[k] = max[k] = values[start + k];
+				for(uint32_t i = start + k; i < end; i += N) {
+					if(min[k] > values[i]) min[k] = values[i];
+					if(max[k] < values[i]) max[k] = values[i];
+				}
+			}
+		});
 		bits = 0;
+		if(!nvert)
+			return;
 		for(int k = 0; k < N; k++) {
-			int min = values[k];
-			int max = min;
-			for(uint32_t i = k; i < n; i +=N) {
-				if(min > values[i]) min = values[i];
-				if(max < values[i]) max = values[i];
+			int min = ranges[k];
+			int max = ranges[N + k];
+			for(size_t t = 1; t + 1 < bounds.size(); t++) {
+				min = std::min(min, ranges[t*N*2 + k]);
+				max = std::max(max, ranges[t*N*2 + N + k]);
 			}
 			max -= min;
 			bits = std::max(bits, ilog2(max-1) + 1);
@@ -127,19 +245,30 @@ public:
 	virtual void deltaEncode(std::vector<Quad> &context) {
 		for(int c = 0; c < N; c++)
 			diffs[c] = values[context[0].t*N + c];
-		for(uint32_t i = 1; i < context.size(); i++) {
-			Quad &q = context[i];
-			if(q.a != q.b && (strategy & PARALLEL)) {
-				for(int c = 0; c < N; c++)
-					diffs[i*N + c] = values[q.t*N + c] - (values[q.a*N + c] + values[q.b*N + c] - values[q.c*N + c]);
-			} else {
-				for(int c = 0; c < N; c++)
-					diffs[i*N + c] = values[q.t*N + c] - values[q.a*N + c];
+		parallelFor(threads, (uint32_t)context.size(), [&](uint32_t start, uint32_t end) {
+			for(uint32_t i = std::max(start, 1u); i < end; i++) {
+				Quad &q = context[i];
+				if(q.a != q.b && (strategy & PARALLEL)) {
+					for(int c = 0; c < N; c++)
+						diffs[i*N + c] = values[q.t*N + c] - (values[q.a*N + c] + values[q.b*N + c] - values[q.c*N + c]);
+				} else {
+					for(int c = 0; c < N; c++)
+						diffs[i*N + c] = values[q.t*N + c] - values[q.a*N + c];
+				}
 			}
-		}
+		});
 		diffs.resize(context.size()*N); //unreferenced vertices
 	}
 
+	virtual void merge(const uint32_t *vertices, uint32_t n) {
+		for(int c = 0; c < N; c++) {
+			int64_t sum = 0;
+			for(uint32_t i = 0; i < n; i++)
+				sum += values[vertices[i]*N + c];
+			values[vertices[0]*N + c] = (T)llround(sum/(double)n);
+		}
+	}
+
 	virtual void encode(uint32_t nvert, OutStream &stream) {
 		stream.restart();
 		if(strategy & CORRELATED)
@@ -150,17 +279,33 @@ public:
 		size = stream.elapsed();
 	}
 
-	virtual void decode(uint32_t /*nvert */, InStream &stream) {
+	virtual void decode(uint32_t nvert, InStream &stream) {
+		if(!inplace())
+			values.resize(nvert*N);
+		if(strategy & CORRELATED)
+			stream.decodeArray<T>(quantized(), N, nvert);
+		else
+			stream.decodeValues<T>(quantized(), N, nvert);
+	}
+
+	//quantized values are decoded in the output buffer, unless the output type is smaller or interleaved.
+	virtual bool inplace() { return formatBytes(format) >= (int)sizeof(T) && rowBytes() == (uint32_t)(N*formatBytes(format)); }
+	T *quantized() { return inplace()? (T *)buffer : values.data(); }
+	uint32_t rowBytes() { return stride? stride : N*formatBytes(format); }
+
+
+	virtual bool skip(InStream &stream) {
 		if(strategy & CORRELATED)
-			stream.decodeArray<T>((T *)buffer, N);
+			stream.skipArray();
 		else
-			stream.decodeValues<T>((T *)buffer, N);
+			stream.skipValues(N);
+		return true;
 	}
 
 	virtual void deltaDecode(uint32_t nvert, std::vector<Face> &context) {
 		if(!buffer) return;
 
-		T *values = (T *)buffer;
+		T *values = quantized();
 
 		if(strategy & PARALLEL) { //parallelogram prediction
 			for(uint32_t i = 1; i < context.size(); i++) {
@@ -175,58 +320,162 @@ public:
 					values[i*N + c] += values[f.a*N + c];
 			}
 		} else {       //point clouds assuming values are already sorted by proximity.
-			for(uint32_t i = N; i < nvert*N; i++) {
-				values[i] += values[i - N];
-			}
+			prefixSum(values, nvert, N, threads);
 		}
 	}
 
 	virtual void dequantize(uint32_t nvert) {
 		if(!buffer) return;
 
-		T *coords = (T *)buffer;
-		uint32_t n = N*nvert;
+		T *coords = quantized();
+		auto scaled = [this](T v, int) { return v*q; };
 		switch(format) {
 		case FLOAT:
-			for(uint32_t i = 0; i < n; i++)
-				((float *)buffer)[i] = coords[i]*q;
-			break;
-
-		case INT16:
-			for(uint32_t i = 0; i < n; i++)
-				((uint16_t *)buffer)[i] *= q;
+			if(inplace())
+				toFloat(coords, (float *)buffer, N*nvert);
+			else
+				write<float>(coords, nvert, scaled);
 			break;
-
-		case INT32:
-			for(uint32_t i = 0; i < n; i++)
-				((uint32_t *)buffer)[i] *= q;
-			break;
-
-		case INT8:
-			for(uint32_t i = 0; i < n; i++)
-				((char *)buffer)[i] *= q;
-			break;
-
-		case DOUBLE:
-			for(uint32_t i = 0; i < n; i++)
-				((double *)buffer)[i] = coords[i]*q;
+		case DOUBLE:  write<double>(coords, nvert, scaled); break;
+		case INT32:   write<int32_t>(coords, nvert, scaled); break;
+		case UINT32:  write<uint32_t>(coords, nvert, scaled); break;
+		case INT16:   write<int16_t>(coords, nvert, scaled); break;
+		case UINT16:  write<uint16_t>(coords, nvert, scaled); break;
+		case INT8:    write<int8_t>(coords, nvert, scaled); break;
+		case UINT8:   write<uint8_t>(coords, nvert, scaled); break;
+		case HALF:    write<uint16_t>(coords, nvert, [this](T v, int) { return toHalf(v*q); }); break;
+		case SNORM16: normalize<int16_t>(coords, nvert, 32767.0, true); break;
+		case UNORM16: normalize<uint16_t>(coords, nvert, 65535.0, false); break;
+		case SNORM8:  normalize<int8_t>(coords, nvert, 127.0, true); break;
+		default:
+#ifndef NO_EXCEPTIONS
+			throw "Unsupported output format.";
+#else
 			break;
+#endif
+		}
+		if(!inplace())
+			std::vector<T>().swap(values);
+	}
 
-		case UINT16:
-			for(uint32_t i = 0; i < n; i++)
-				((uint16_t *)buffer)[i] *= q;
-			break;
+	virtual void deltaDequantize(uint32_t nvert, std::vector<Face> &context) {
+		if(!buffer) return;
+		if(format != FLOAT || sizeof(T) != sizeof(float)) {
+			VertexAttribute::deltaDequantize(nvert, context);
+			return;
+		}
 
-		case UINT32:
-			for(uint32_t i = 0; i < n; i++)
-				((uint32_t *)buffer)[i] *= q;
-			break;
+		//each value is read as integer, then its float overwrites it (or goes to its row if interleaved).
+		const T *diff = quantized();
+		uint32_t row = rowBytes();
+		uint32_t i = 0;
+		if(context.size()) {
+			//predictors can be any previous vertex, keep the integers aside.
+			std::vector<T> aside;
+			T *v = values.data();
+			if(inplace()) {
+				aside.resize(context.size()*N);
+				v = aside.data();
+			}
+			float *out = (float *)buffer;
+			for(int c = 0; c < N; c++) {
+				v[c] = diff[c];
+				out[c] = v[c]*q;
+			}
+			if(strategy & PARALLEL) {
+				for(i = 1; i < context.size(); i++) {
+					Face &f = context[i];
+					out = (float *)(buffer + i*row);
+					for(int c = 0; c < N; c++) {
+						uint32_t k = i*N + c;
+						v[k] = diff[k] + v[f.a*N + c] + v[f.b*N + c] - v[f.c*N + c];
+						out[c] = v[k]*q;
+					}
+				}
+			} else {
+				for(i = 1; i < context.size(); i++) {
+					Face &f = context[i];
+					out = (float *)(buffer + i*row);
+					for(int c = 0; c < N; c++) {
+						uint32_t k = i*N + c;
+						v[k] = diff[k] + v[f.a*N + c];
+						out[c] = v[k]*q;
+					}
+				}
+			}
+			i = context.size();
+
+		} else { //point clouds: running sum of the integers, each block scaled right after.
+			T *v = quantized();
+			prefixSum(v, nvert, N, threads, [&](uint32_t start, uint32_t end) {
+				if(inplace()) {
+					toFloat(v + start*N, (float *)buffer + start*N, (end - start)*N);
+					return;
+				}
+				for(uint32_t k = start; k < end; k++) {
+					float *out = (float *)(buffer + k*row);
+					for(int c = 0; c < N; c++)
+						out[c] = v[k*N + c]*q;
+				}
+			});
+			i = nvert;
+		}
+		//unreferenced vertices
+		for(; i < nvert; i++) {
+			float *out = (float *)(buffer + i*row);
+			for(int c = 0; c < N; c++)
+				out[c] = diff[i*N + c]*q;
+		}
+		if(!inplace())
+			std::vector<T>().swap(values);
+	}
 
-		case UINT8:
-			for(uint32_t i = 0; i < n; i++)
-				((char *)buffer)[i] *= q;
-			break;
+protected:
+	//int values take the vectorized path.
+	void toFloat(const int32_t *values, float *out, uint32_t n) {
+		Simd::scale(values, out, n, q);
+	}
+	template <class S> void toFloat(const S *values, float *out, uint32_t n) {
+		for(uint32_t i = 0; i < n; i++)
+			out[i] = values[i]*q;
+	}
+	//rows are rowBytes() apart, in reverse so it works in place for output types as large as T or larger.
+	template <class S, class F> void write(const T *values, uint32_t nvert, F f) {
+		uint32_t row = rowBytes();
+		for(uint32_t i = nvert; i > 0; i--) {
+			S *out = (S *)(buffer + (i - 1)*row);
+			const T *v = values + (i - 1)*N;
+			for(int c = N - 1; c >= 0; c--)
+				out[c] = (S)f(v[c], c);
+		}
+	}
+	//map each component range to [-unit, unit] (signed) or [0, unit], rounding to nearest.
+	template <class S> void normalize(const T *values, uint32_t nvert, double unit, bool sign) {
+		offset.assign(N, 0.0f);
+		scale.assign(N, 0.0f);
+		if(!nvert) return;
+
+		std::vector<T> lo(values, values + N), hi(values, values + N);
+		for(uint32_t i = 1; i < nvert; i++) {
+			const T *v = values + i*N;
+			for(int c = 0; c < N; c++) {
+				lo[c] = std::min(lo[c], v[c]);
+				hi[c] = std::max(hi[c], v[c]);
+			}
+		}
+		std::vector<double> center(N), k(N);
+		for(int c = 0; c < N; c++) {
+			double range = (double)hi[c] - (double)lo[c];
+			center[c] = lo[c];
+			if(sign) {
+				range /= 2;
+				center[c] += range;
+			}
+			k[c] = range > 0? unit/range : 0.0;
+			offset[c] = (float)(center[c]*q);
+			scale[c] = (float)(range*q);
 		}
+		write<S>(values, nvert, [&](T v, int c) { return lround((v - center[c])*k[c]); });
 	}
 };
 
@@ -0,0 +1,116 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received 
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRT_WORKERS_H
+#define CRT_WORKERS_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#ifndef NO_THREADS
+#include <thread>
+#include <functional>
+#include <exception>
+#endif
+
+namespace crt {
+
+#ifndef NO_THREADS
+//runs jobs on worker threads while the calling thread does something else.
+class Workers {
+public:
+	std::vector<std::thread> pool;
+	std::vector<std::exception_ptr> errors; //one per job, rethrown by join.
+
+	~Workers() { wait(); }
+
+	void start(int nthreads, size_t njobs, std::function<void(size_t)> job) {
+		errors.resize(njobs);
+		for(int w = 0; w < nthreads; w++) {
+			pool.emplace_back([this, w, nthreads, njobs, job]() {
+				for(size_t i = w; i < njobs; i += nthreads) {
+#ifndef NO_EXCEPTIONS
+					try {
+						job(i);
+					} catch(...) {
+						errors[i] = std::current_exception();
+					}
+#else
+					job(i);
+#endif
+				}
+			});
+		}
+	}
+
+	void join() {
+		wait();
+#ifndef NO_EXCEPTIONS
+		for(std::exception_ptr &e: errors)
+			if(e) std::rethrow_exception(e);
+#endif
+	}
+
+private:
+	void wait() {
+		for(std::thread &t: pool)
+			t.join();
+		pool.clear();
+	}
+};
+#endif
+
+//one range per thread, none smaller than min items: range t is [bounds[t], bounds[t+1]).
+inline std::vector<uint32_t> splitRanges(uint32_t n, int threads, uint32_t min = 4096) {
+	int count = 1;
+#ifndef NO_THREADS
+	count = std::max(1, std::min(threads, (int)(n/min)));
+#else
+	(void)threads;
+	(void)min;
+#endif
+	std::vector<uint32_t> bounds(count + 1);
+	for(int t = 0; t <= count; t++)
+		bounds[t] = (uint32_t)((uint64_t)n*t/count);
+	return bounds;
+}
+
+//job(t) for each range, on worker threads when there is more than one.
+template <class F> void forRanges(const std::vector<uint32_t> &bounds, F job) {
+	size_t n = bounds.size() - 1;
+#ifndef NO_THREADS
+	if(n > 1) {
+		Workers workers;
+		workers.start((int)n, n, job);
+		workers.join();
+		return;
+	}
+#endif
+	for(size_t t = 0; t < n; t++)
+		job(t);
+}
+
+//job(start, end) on ranges covering [0, n).
+template <class F> void parallelFor(int threads, uint32_t n, F job) {
+	std::vector<uint32_t> bounds = splitRanges(n, threads);
+	forRanges(bounds, [&](size_t t) { job(bounds[t], bounds[t + 1]); });
+}
+
+} //namespace
+
+#endif // CRT_WORKERS_H
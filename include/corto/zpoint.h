@@ -20,7 +20,10 @@ If not, see <http://www.gnu.org/licenses/>.
 #define CRT_ZPOINT_H
 
 #include <stdint.h>
+#include <string.h>
+#include <vector>
 #include "point.h"
+#include "workers.h"
 
 namespace crt {
 
@@ -30,10 +33,20 @@ public:
 	uint32_t pos;
 
 	ZPoint(uint64_t b = 0): bits(b), pos(-1) {}
-	ZPoint(uint64_t x, uint64_t y, uint64_t z, int levels, int i): bits(0), pos(i) {
-		uint64_t l = 1;
-		for (int i = 0; i < levels; i++)
-			bits |= (x & l << i)<< (2*i) | (y & l << i) << (2*i + 1) | (z & l << i) << (2*i+2);
+	//interleave the lowest levels bits (at most 21) of x, y and z.
+	ZPoint(uint64_t x, uint64_t y, uint64_t z, int levels, int i): pos(i) {
+		uint64_t mask = levels < 21? (1ull << levels) - 1 : 0x1fffffull;
+		bits = split3(x & mask) | split3(y & mask) << 1 | split3(z & mask) << 2;
+	}
+
+	//inverse of morton3: spread 21 bits two zeros apart.
+	static uint64_t split3(uint64_t x) {
+		x = (x | (x << 32)) & 0x001f00000000ffffull;
+		x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+		x = (x | (x << 8))  & 0x100f00f00f00f00full;
+		x = (x | (x << 4))  & 0x10c30c30c30c30c3ull;
+		x = (x | (x << 2))  & 0x1249249249249249ull;
+		return x;
 	}
 
 	uint64_t morton2(uint64_t x)
@@ -121,5 +134,48 @@ public:
 	}
 };
 
+//increasing morton order, stable: equal points keep the input order.
+//LSD radix sort 8 bits at a time, skipping the bytes where all the keys agree.
+inline void radixSort(std::vector<ZPoint> &points, int threads) {
+	uint32_t n = points.size();
+	uint64_t all = n? points[0].bits : 0; //bits set in every key
+	uint64_t any = 0;                      //bits set in some key
+	for(ZPoint &p: points) {
+		all &= p.bits;
+		any |= p.bits;
+	}
+	uint64_t differ = all ^ any;
+
+	std::vector<ZPoint> sorted(n);
+	std::vector<uint32_t> bounds = splitRanges(n, threads, 1<<16);
+	std::vector<uint32_t> counts((bounds.size() - 1)*256);
+	for(int shift = 0; shift < 64; shift += 8) {
+		if(((differ >> shift) & 0xff) == 0)
+			continue;
+
+		forRanges(bounds, [&](size_t t) {
+			uint32_t *count = &counts[t*256];
+			memset(count, 0, 256*sizeof(uint32_t));
+			for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++)
+				count[(points[i].bits >> shift) & 0xff]++;
+		});
+		//digit first, then range: each range scatters after the previous ones.
+		uint32_t offset = 0;
+		for(int d = 0; d < 256; d++) {
+			for(size_t t = 0; t + 1 < bounds.size(); t++) {
+				uint32_t c = counts[t*256 + d];
+				counts[t*256 + d] = offset;
+				offset += c;
+			}
+		}
+		forRanges(bounds, [&](size_t t) {
+			uint32_t *count = &counts[t*256];
+			for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++)
+				sorted[count[(points[i].bits >> shift) & 0xff]++] = points[i];
+		});
+		points.swap(sorted);
+	}
+}
+
 }//namespace
 #endif // CRT_ZPOINT_H
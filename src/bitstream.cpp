@@ -106,7 +106,7 @@ uint32_t BitStream::read(int numbits) {
 		uint32_t result = (buff << bits); //looks the same.
 		bits = 32 - bits;
 
-		buff = *pos++;
+		memcpy(&buff, pos++, sizeof(uint32_t)); //the words might not be aligned (mapped files, archives).
 		result |= (buff >> bits);
 		buff = (buff & ((1<<bits)-1)); //slighting faster than mask.
 		return result;
@@ -20,99 +20,132 @@ If not, see <http://www.gnu.org/licenses/>.
 using namespace crt;
 
 
+//colors are converted a block at a time: expanded to 4 components for the vectorized lifting.
+static const uint32_t block = 256;
+
 void ColorAttr::quantize(uint32_t nvert, const char *buffer) {
 	uint32_t n = N*nvert;
 
 	values.resize(n);
 	diffs.resize(n);
-	switch(format) {
-	case UINT8:
-	{
-		const uint8_t *c = (const uint8_t *)buffer;
-		uint8_t *v = values.data();		
-		Color4b y;
-		for(uint32_t i = 0; i < nvert; i++) {
-			for(int k = 0; k < N; k++)
-				y[k] = c[k]/qc[k];
-			y = y.toYCC();
-			for(int k = 0; k < N; k++)
-				v[k] = y[k];
-			c += N;
-			v += N;
-		}
-	}
-		break;
-
-	case FLOAT:
-	{
-		Color4b y;
-		y[3] = 255;
-		const float *c = (const float *)buffer;
-		uint8_t *v = values.data();
-		for(uint32_t i = 0; i < nvert; i++) {
-			for(int k = 0; k < N; k++)
-				y[k] = ((int)(c[k]*255.0f))/qc[k];
-			y = y.toYCC();
-			for(int k = 0; k < N; k++)
-				v[k] = y[k];
-			c += N;
-			v += N;
-		}
-	}
-		break;
+	if(format != UINT8 && format != FLOAT) {
 #ifndef NO_EXCEPTIONS
-	default: throw "Unsupported color input format.";
+		throw "Unsupported color input format.";
 #else
-	default: break;
+		return;
 #endif
 	}
+
+	parallelFor(threads, nvert, [&](uint32_t first, uint32_t last) {
+		Color4b colors[block];
+		const int one[4] = { 1, 1, 1, 1 };
+		for(uint32_t start = first; start < last; start += block) {
+			uint32_t count = std::min(block, last - start);
+			if(format == UINT8) {
+				const uint8_t *c = (const uint8_t *)buffer + start*N;
+				for(uint32_t i = 0; i < count; i++, c += N) {
+					colors[i][3] = 255;
+					for(int k = 0; k < N; k++)
+						colors[i][k] = c[k];
+				}
+				Simd::toYCC((uchar *)colors, count, qc);
+			} else {
+				const float *c = (const float *)buffer + start*N;
+				for(uint32_t i = 0; i < count; i++, c += N) {
+					colors[i][3] = 255;
+					for(int k = 0; k < N; k++)
+						colors[i][k] = ((int)(c[k]*255.0f))/qc[k];
+				}
+				Simd::toYCC((uchar *)colors, count, one);
+			}
+			uint8_t *v = values.data() + start*N;
+			for(uint32_t i = 0; i < count; i++, v += N)
+				for(int k = 0; k < N; k++)
+					v[k] = colors[i][k];
+		}
+	});
 	bits = 0;
 }
 
-void ColorAttr::dequantize(uint32_t nvert) {
-	if(!buffer) return;
-
-	switch(format) {
-	case UINT8:
-	{
-		//this is inplace decoding! goiong from 3 to 4 require going in reverse.
-		uint8_t *c = ((uint8_t *)buffer) + N*nvert;
-		uint8_t *target = ((uint8_t *)buffer) + out_components*nvert;
-		Color4b color;
+void ColorAttr::toRGB(const uchar *c, Color4b *rgb, uint32_t n) {
+	for(uint32_t i = 0; i < n; i++, c += N) {
+		Color4b &color = rgb[i];
 		color[3] = 255;
-		
-		while(c > (uint8_t *)buffer) {
-			c -= N;
-			target -= out_components;
-			
-			for(int k = 0; k < N; k++)
-				color[k] = c[k];
-			color = color.toRGB();
-			for(int k = 0; k < out_components; k++)
-				target[k] = color[k]*qc[k];
-		}
-		break;
+		for(int k = 0; k < N; k++)
+			color[k] = c[k];
 	}
-	case FLOAT:
-	{
-		std::vector<Color4b> colors(nvert);
-		memcpy(colors.data(), buffer, nvert*sizeof(Color4b));
-		float *c = (float *)buffer;
-		
-		for(uint32_t i = 0; i < nvert; i++) {
-			Color4b &rgb = colors[i];
-			rgb = rgb.toRGB();
+	Simd::toRGB((uchar *)rgb, n, qc);
+}
+
+void ColorAttr::store(const Color4b *rgb, uint32_t n, char *out) {
+	uchar *target = (uchar *)out;
+	uchar packed[block*4];
+	if(format == FLOAT) //compact to bytes, then to floats.
+		target = packed;
+
+	if(out_components == 4)
+		memcpy(target, rgb, n*4);
+	else
+		for(uint32_t i = 0; i < n; i++)
 			for(int k = 0; k < out_components; k++)
-				c[k] = (c[k]*qc[k])/255.0f;
-			c += out_components;
-		}
-		break;
+				target[i*out_components + k] = rgb[i][k];
+
+	if(format == FLOAT)
+		Simd::toFloat(packed, (float *)out, n*out_components);
+}
+
+void ColorAttr::merge(const uint32_t *vertices, uint32_t n) {
+	uint32_t sum[4] = { 0, 0, 0, 0 };
+	for(uint32_t i = 0; i < n; i++) {
+		const uchar *c = &values[vertices[i]*N];
+		//missing components repeat the first one, only the first N are stored back.
+		Color4b rgb = Color4b(c[0], N > 1? c[1] : c[0], N > 2? c[2] : c[0], N > 3? c[3] : 255).toRGB();
+		for(int k = 0; k < 4; k++)
+			sum[k] += rgb[k];
 	}
+	Color4b average;
+	for(int k = 0; k < 4; k++)
+		average[k] = (uchar)((sum[k] + n/2)/n);
+	average = average.toYCC();
+	for(int k = 0; k < N; k++)
+		values[vertices[0]*N + k] = average[k];
+}
+
+void ColorAttr::dequantize(uint32_t nvert) {
+	if(!buffer) return;
+
 #ifndef NO_EXCEPTIONS
-	default: throw "Unsupported color output format.";
-#else
-	default: break;
+	if(format != UINT8 && format != FLOAT)
+		throw "Unsupported color output format.";
 #endif
 
+	Color4b rgb[block];
+	uint32_t bytes = out_components*formatBytes(format);
+	if(!inplace()) { //interleaved or 4 to 3 components
+		uint32_t row = stride? stride : bytes;
+		std::vector<char> packed(block*bytes);
+		for(uint32_t start = 0; start < nvert; start += block) {
+			uint32_t n = std::min(block, nvert - start);
+			toRGB(values.data() + start*N, rgb, n);
+			store(rgb, n, packed.data());
+			for(uint32_t i = 0; i < n; i++)
+				memcpy(buffer + (start + i)*row, packed.data() + i*bytes, bytes);
+		}
+		std::vector<uchar>().swap(values);
+		return;
+	}
+
+	if(format == UINT8 && N == 4 && out_components == 4) {
+		Simd::toRGB((uchar *)buffer, nvert, qc);
+		return;
+	}
+
+	//this is inplace decoding! output is never smaller than the input: going in reverse
+	//a block is copied aside before being overwritten.
+	for(uint32_t done = 0; done < nvert; done += block) {
+		uint32_t n = std::min(block, nvert - done);
+		uint32_t start = nvert - done - n;
+		toRGB((uchar *)buffer + start*N, rgb, n);
+		store(rgb, n, buffer + start*bytes);
 	}
 }
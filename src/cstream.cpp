@@ -19,6 +19,7 @@ If not, see <http://www.gnu.org/licenses/>.
 #include "cstream.h"
 
 #include "tunstall.h"
+#include "workers.h"
 #ifdef ENTROPY_TESTS
 #include "lz4/lz4.h"
 #include "lz4/lz4hc.h"
@@ -39,6 +40,96 @@ namespace crt {
 
 }
 
+#ifdef _WIN32
+static int64_t tell(FILE *file) { return _ftelli64(file); }
+static bool seek(FILE *file, int64_t offset) { return _fseeki64(file, offset, SEEK_SET) == 0; }
+#else
+static int64_t tell(FILE *file) { return ftello(file); }
+static bool seek(FILE *file, int64_t offset) { return fseeko(file, offset, SEEK_SET) == 0; }
+#endif
+
+FileSink::FileSink(FILE *_file): file(_file), start(tell(_file)), length(0) {
+	if(start < 0) //not seekable
+		start = 0;
+}
+
+void FileSink::write(const uchar *data, size_t size) {
+	if(fwrite(data, 1, size, file) != size)
+		failed = true;
+	length += size;
+}
+
+void FileSink::rewrite(size_t offset, const uchar *data, size_t size) {
+	if(offset > length || size > length - offset) {
+		failed = true;
+		return;
+	}
+	if(!seek(file, start + (int64_t)offset) || fwrite(data, 1, size, file) != size)
+		failed = true;
+	if(!seek(file, start + (int64_t)length))
+		failed = true;
+}
+
+void OutStream::flush() {
+	if(!sink || buffer.empty())
+		return;
+	sink->write(buffer.data(), buffer.size());
+	flushed += buffer.size();
+	buffer.clear();
+	pads.clear();
+}
+
+void OutStream::rewrite(size_t offset, const uchar *data, size_t s) {
+#ifndef NO_EXCEPTIONS
+	if(offset > size() || s > size() - offset)
+		throw "Rewrite past the end of the stream.";
+#else
+	assert(offset <= size() && s <= size() - offset);
+#endif
+	if(offset < flushed) { //the first bytes are already in the sink.
+		size_t n = std::min(s, flushed - offset);
+		sink->rewrite(offset, data, n);
+		offset += n;
+		data += n;
+		s -= n;
+	}
+	if(s)
+		memcpy(buffer.data() + offset - flushed, data, s);
+}
+
+void OutStream::compress(std::vector<std::vector<uchar> > &arrays) {
+#ifndef NO_THREADS
+	if(threads > 1 && arrays.size() > 1) {
+		std::vector<OutStream> parts(arrays.size());
+		Workers workers;
+		workers.start(std::min<int>(threads, (int)arrays.size()), arrays.size(), [&](size_t i) {
+			parts[i].entropy = entropy;
+			parts[i].compress((uint32_t)arrays[i].size(), arrays[i].data());
+		});
+		workers.join();
+		for(OutStream &part: parts)
+			append(part);
+		return;
+	}
+#endif
+	for(std::vector<uchar> &array: arrays)
+		compress((uint32_t)array.size(), array.data());
+}
+
+void OutStream::append(OutStream &stream) {
+#ifndef NO_EXCEPTIONS
+	if(stream.flushed)
+		throw "Cannot append a stream written to a sink.";
+#endif
+	size_t pos = 0;
+	for(auto &pad: stream.pads) {
+		push(stream.buffer.data() + pos, pad.first - pos);
+		align();
+		pos = pad.first + pad.second;
+	}
+	push(stream.buffer.data() + pos, stream.buffer.size() - pos);
+}
+
 //TODO uniform notation length first, pointer after everywhere
 int OutStream::compress(uint32_t size, uchar *data) {
 	switch(entropy) {
@@ -86,6 +177,37 @@ void InStream::decompress(vector<uchar> &data) {
 	}
 }
 
+void InStream::skipCompressed() {
+	switch(entropy) {
+	case NONE:
+		readArray<uchar>(readUint32());
+		break;
+	case TUNSTALL: {
+		int nsymbols = readUint8();
+		readArray<uchar>(nsymbols*2);
+		readUint32(); //size
+		readArray<uchar>(readUint32());
+		break;
+	}
+#ifdef ENTROPY_TESTS
+	case ZLIB:
+	case LZ4: {
+		uint32_t size = readUint32();
+		uint32_t compressed_size = readUint32();
+		if(size)
+			readArray<uchar>(compressed_size);
+		break;
+	}
+#endif
+	default:
+#ifndef NO_EXCEPTIONS
+		throw "Unknown entropy";
+#else
+		break;
+#endif
+	}
+}
+
 int OutStream::tunstall_compress(uchar *data, int size) {
 	Tunstall t;
 	t.getProbabilities(data, size);
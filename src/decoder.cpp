@@ -25,6 +25,7 @@ If not, see <http://www.gnu.org/licenses/>.
 
 #include "tunstall.h"
 #include "decoder.h"
+#include "workers.h"
 
 using namespace std;
 using namespace crt;
@@ -38,19 +39,121 @@ public:
 		v0(a), v1(b), v2(c), prev(p), next(n), deleted(false) {}
 };
 
-Decoder::Decoder(int len, const uchar *input): vertex_count(0) {
+//records the prediction of each new vertex, deltaDecode will use it later.
+class FacePredictor {
+public:
+	std::vector<Face> &prediction;
+	FacePredictor(std::vector<Face> &p): prediction(p) {}
+	void operator()(uint32_t v, uint32_t a, uint32_t b, uint32_t c) {
+		prediction[v] = Face(a, b, c);
+	}
+};
+
+//same as GenericAttr::deltaDecode, but a vertex at a time.
+template <class T> class DeltaTarget {
+public:
+	T *values;
+	int N;
+	bool parallel;
+	DeltaTarget(T *v, int n, bool p): values(v), N(n), parallel(p) {}
+
+	void predict(uint32_t v, uint32_t a, uint32_t b, uint32_t c) {
+		T *t = values + v*N;
+		if(parallel) {
+			for(int k = 0; k < N; k++)
+				t[k] += values[a*N + k] + values[b*N + k] - values[c*N + k];
+		} else {
+			for(int k = 0; k < N; k++)
+				t[k] += values[a*N + k];
+		}
+	}
+};
+
+//reconstructs the attributes as soon as each vertex is emitted: the predicting vertices are already decoded.
+class FusedPredictor {
+public:
+	std::vector<DeltaTarget<int32_t> > ints;
+	std::vector<DeltaTarget<uchar> > bytes;
+
+	//return false if some attribute can't be fused (custom attributes, for example).
+	bool add(VertexAttribute *attr) {
+		if(!attr->buffer) return true;
+		bool parallel = (attr->strategy & VertexAttribute::PARALLEL) != 0;
+
+		switch(attr->codec()) {
+		case VertexAttribute::GENERIC_CODEC: {
+			GenericAttr<int> *generic = dynamic_cast<GenericAttr<int> *>(attr);
+			if(!generic) return false;
+			ints.push_back(DeltaTarget<int32_t>(generic->quantized(), generic->N, parallel));
+			return true;
+		}
+		case VertexAttribute::NORMAL_CODEC: {
+			NormalAttr *normal = dynamic_cast<NormalAttr *>(attr);
+			if(!normal) return false;
+			if(normal->prediction == NormalAttr::DIFF) //estimated and border do not use the prediction.
+				ints.push_back(DeltaTarget<int32_t>(normal->diffs.data(), 2, false));
+			return true;
+		}
+		case VertexAttribute::COLOR_CODEC: {
+			ColorAttr *color = dynamic_cast<ColorAttr *>(attr);
+			if(!color) return false;
+			bytes.push_back(DeltaTarget<uchar>(color->quantized(), color->N, parallel));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	void operator()(uint32_t v, uint32_t a, uint32_t b, uint32_t c) {
+		if(v == 0) return; //first vertex is not predicted
+		for(DeltaTarget<int32_t> &t: ints)
+			t.predict(v, a, b, c);
+		for(DeltaTarget<uchar> &t: bytes)
+			t.predict(v, a, b, c);
+	}
+};
+
+//writes indices relative to a base vertex, and tracks the lowest vertex referenced.
+template <class I> class FaceOutput {
+public:
+	I *faces;
+	uint32_t base;
+	uint32_t lowest; //only splits can reference vertices preceding the group.
+	FaceOutput(I *f, uint32_t b): faces(f), base(b), lowest(b) {}
+
+	void write(uint32_t pos, uint32_t v) { faces[pos] = (I)(v - base); }
+	void split(uint32_t v) {
+		if(v < lowest) lowest = v;
+	}
+};
+
+Decoder::Decoder(size_t len, const uchar *input): nvert(0), nface(0), fuse_prediction(false), threads(1), version(0), vertex_count(0) {
+	init(len, input);
+}
+
+Decoder::Decoder(const char *filename): nvert(0), nface(0), fuse_prediction(false), threads(1), version(0), vertex_count(0) {
+	if(!file.open(filename)) {
 #ifndef NO_EXCEPTIONS
-	if((uintptr_t)input & 0x3)
-		throw "Memory must be alignegned on 4 bytes.";
+		throw "Could not open file.";
 #endif
+		return; //no attributes: decode does nothing.
+	}
+	init(file.size(), file.data());
+}
 
+void Decoder::init(size_t len, const uchar *input) {
 	stream.init(len, input);
 	uint32_t magic = stream.readUint32();
 #ifndef NO_EXCEPTIONS
 	if(magic != 0x787A6300)
 		throw "Not a crt file.";
 #endif
-	uint32_t version = stream.readUint32();
+	version = stream.readUint32();
+#ifndef NO_EXCEPTIONS
+	if(version > 2)
+		throw "Unsupported crt version.";
+#endif
 	stream.entropy = (Stream::Entropy)stream.readUint8();
 
 	uint32_t size = stream.readUint32();
@@ -86,6 +189,15 @@ Decoder::Decoder(int len, const uchar *input): vertex_count(0) {
 	}
 	nvert = stream.readUint32();
 	nface = stream.readUint32();
+
+	if(version > 1) {
+		substreams.resize(nattr + 1);
+		for(Substream &s: substreams) {
+			s.offset = stream.readUint32();
+			s.length = stream.readUint32();
+		}
+	}
+	index.decodeGroups(stream);
 }
 
 Decoder::~Decoder() {
@@ -94,10 +206,15 @@ Decoder::~Decoder() {
 }
 
 bool Decoder::setAttribute(const char *name, char *buffer, VertexAttribute::Format format) {
+	return setAttribute(name, buffer, format, 0, 0);
+}
+
+bool Decoder::setAttribute(const char *name, char *base, VertexAttribute::Format format, uint32_t stride, uint32_t offset) {
 	if(data.find(name) == data.end()) return false;
 	VertexAttribute *attr = data[name];
 	attr->format = format;
-	attr->buffer = buffer;
+	attr->buffer = base + offset;
+	attr->stride = stride;
 	return true;
 }
 
@@ -114,15 +231,30 @@ bool Decoder::setAttribute(const char *name, char *buffer, VertexAttribute *attr
 }
 
 bool Decoder::setColors(uchar *buffer, int components) { 
+	return setColors(buffer, components, 0, 0);
+}
+
+bool Decoder::setColors(uchar *base, int components, uint32_t stride, uint32_t offset) {
 	if(data.find("color") == data.end()) return false;
 	ColorAttr *attr = dynamic_cast<crt::ColorAttr *>(data["color"]);
 	attr->format = VertexAttribute::UINT8;
-	attr->buffer = (char *)buffer;
+	attr->buffer = (char *)base + offset;
+	attr->stride = stride;
 	attr->out_components = components;
 	return true;
 }
 
 
+uint32_t Decoder::setLevels(uint32_t levels) {
+	uint32_t size = index.groups.size();
+	if(nface > 0 || size == 0)
+		return nvert;
+	if(levels == 0 || levels > size) //all of them
+		levels = size;
+	nvert = index.groups[levels - 1].end;
+	return nvert;
+}
+
 void Decoder::decode() {
 	if(nface > 0)
 		decodeMesh();
@@ -130,19 +262,67 @@ void Decoder::decode() {
 		decodePointCloud();
 }
 
+//find where each bound attribute stream starts without decoding, return false if some attribute can't be skipped.
+bool Decoder::locateStreams(std::vector<VertexAttribute *> &attrs, std::vector<InStream> &streams) {
+	InStream s = stream;
+	if(nface > 0 && !substreams.size())
+		index.skip(s);
+
+	uint32_t k = 1; //substreams[0] is the index
+	for(auto it: data) {
+		VertexAttribute *attr = it.second;
+		if(substreams.size())
+			s.seek(substreams[k++].offset);
+		if(attr->buffer) {
+			attrs.push_back(attr);
+			streams.push_back(s);
+		}
+		if(!substreams.size() && !attr->skip(s))
+			return false;
+	}
+	return true;
+}
+
+//entropy decode attributes in stream order, unbound attributes are skipped.
+void Decoder::decodeAttributes() {
+	uint32_t k = 1;
+	for(auto it: data) {
+		VertexAttribute *attr = it.second;
+		if(substreams.size())
+			stream.seek(substreams[k++].offset);
+		if(!attr->buffer && (substreams.size() || attr->skip(stream)))
+			continue;
+		attr->decode(nvert, stream);
+	}
+}
+
 void Decoder::decodePointCloud() {
 
 	std::vector<crt::Face> dummy;
-
-	index.decodeGroups(stream);
-	for(auto it: data)
-		it.second->decode(nvert, stream);
 	for(auto it: data)
-		it.second->deltaDecode(nvert, dummy);
-	/*	for(auto it: data)
-		it.second->postDelta(nvert, dummy); */
+		it.second->threads = threads;
+
+	bool parallel = false;
+#ifndef NO_THREADS
+	std::vector<VertexAttribute *> attrs;
+	std::vector<InStream> streams;
+	if(threads > 1 && locateStreams(attrs, streams)) {
+		//entropy decoding is serial within an attribute: one attribute per thread.
+		parallel = true;
+		Workers workers;
+		workers.start(std::min<int>(threads, (int)attrs.size()), attrs.size(), [&](size_t i) {
+			attrs[i]->decode(nvert, streams[i]);
+		});
+		workers.join();
+	}
+#endif
+	if(!parallel)
+		decodeAttributes();
+
+	//no postDelta for point clouds: each attribute is dequantized as soon as it is reconstructed,
+	//the running sums of the deltas are split among the threads.
 	for(auto it: data)
-		it.second->dequantize(nvert);
+		it.second->deltaDequantize(nvert, dummy);
 
 }
 /*
@@ -162,19 +342,41 @@ void Decoder::decodePointCloud() {
 	*/
 
 void Decoder::decodeMesh() {
-	index.decodeGroups(stream);
+	bool parallel = false;
+#ifndef NO_THREADS
+	//attributes entropy decoding does not depend on connectivity, only deltaDecode does.
+	std::vector<VertexAttribute *> attrs;
+	std::vector<InStream> streams;
+	Workers workers;
+	if(threads > 1 && locateStreams(attrs, streams)) {
+		parallel = true;
+		workers.start(std::min<int>(threads - 1, (int)attrs.size()), attrs.size(), [&](size_t i) {
+			attrs[i]->decode(nvert, streams[i]);
+		});
+	}
+#endif
+
 	index.decode(stream);
 
-	for(auto it: data)
-		it.second->decode(nvert, stream);
+	if(!parallel)
+		decodeAttributes();
 
-	index.prediction.resize(nvert);
+	bool fuse = fuse_prediction;
+#ifndef NO_THREADS
+	if(fuse)
+		workers.join(); //fused prediction needs attributes already decoded.
+#endif
 
-	uint32_t start = 0;
-	uint32_t cler = 0; //keeps track of current cler
-	for(Group &g: index.groups) {
-		decodeFaces(start*3, g.end*3, cler);
-		start = g.end;
+	FusedPredictor fused;
+	for(auto it: data)
+		fuse = fuse && fused.add(it.second);
+
+	if(fuse) {
+		decodeConnectivity(fused);
+	} else {
+		index.prediction.resize(nvert);
+		FacePredictor predictor(index.prediction);
+		decodeConnectivity(predictor);
 	}
 
 #ifdef PRESERVED_UNREFERENCED
@@ -185,14 +387,73 @@ void Decoder::decodeMesh() {
 	}
 #endif
 
-	for(auto it: data)
-		it.second->deltaDecode(nvert, index.prediction);
+#ifndef NO_THREADS
+	workers.join();
+#endif
+
+	//normal estimation (and custom attributes) might need the quantized positions in postDelta.
+	bool quantized_positions = false;
+	for(auto it: data) {
+		VertexAttribute *attr = it.second;
+		NormalAttr *normal = dynamic_cast<NormalAttr *>(attr);
+		if(attr->buffer && (attr->codec() >= VertexAttribute::CUSTOM_CODEC || (normal && normal->prediction != NormalAttr::DIFF)))
+			quantized_positions = true;
+		if(normal)
+			normal->threads = threads;
+	}
+
+	//generic attributes not needed by postDelta are reconstructed and dequantized in a single pass.
+	std::vector<VertexAttribute *> pending;
+	for(auto it: data) {
+		VertexAttribute *attr = it.second;
+		bool single = !fuse && attr->codec() == VertexAttribute::GENERIC_CODEC && !(quantized_positions && it.first == "position");
+		if(single) {
+			attr->deltaDequantize(nvert, index.prediction);
+			continue;
+		}
+		if(!fuse)
+			attr->deltaDecode(nvert, index.prediction);
+		pending.push_back(attr);
+	}
 
 	for(auto it: data)
 		it.second->postDelta(nvert, nface, data, index);
 
-	for(auto it: data)
-		it.second->dequantize(nvert);
+	for(VertexAttribute *attr: pending)
+		attr->dequantize(nvert);
+}
+
+//index type is chosen once per group, not for every index.
+template <class Predictor> void Decoder::decodeConnectivity(Predictor &predict) {
+	uint32_t start = 0;
+	uint32_t cler = 0; //keeps track of current cler
+	for(Group &g: index.groups) {
+		if(index.faces16 && index.group_base) {
+			FaceOutput<uint16_t> out(index.faces16, vertex_count);
+			decodeFaces(start*3, g.end*3, cler, out, predict);
+
+#ifndef NO_EXCEPTIONS
+			if(vertex_count - out.lowest > 65536)
+				throw "Group spans more than 64K vertices, use 32 bit indices.";
+#endif
+			//splits referenced previous groups vertices: shift the base down.
+			if(out.lowest < out.base) {
+				uint16_t shift = (uint16_t)(out.base - out.lowest);
+				for(uint32_t i = start*3; i < g.end*3; i++)
+					index.faces16[i] += shift;
+			}
+			g.base = out.lowest;
+
+		} else if(index.faces16) {
+			FaceOutput<uint16_t> out(index.faces16, 0);
+			decodeFaces(start*3, g.end*3, cler, out, predict);
+
+		} else {
+			FaceOutput<uint32_t> out(index.faces32, 0);
+			decodeFaces(start*3, g.end*3, cler, out, predict);
+		}
+		start = g.end;
+	}
 }
 
 /*static int ilog2(uint64_t p) {
@@ -201,7 +462,7 @@ void Decoder::decodeMesh() {
 	return k;
 }*/
 
-void Decoder::decodeFaces(uint32_t start, uint32_t end, uint32_t &cler) {
+template <class Output, class Predictor> void Decoder::decodeFaces(uint32_t start, uint32_t end, uint32_t &cler, Output &out, Predictor &predict) {
 
 	//edges of the mesh to be processed
 	vector<DEdge2> front;
@@ -237,16 +498,14 @@ void Decoder::decodeFaces(uint32_t start, uint32_t end, uint32_t &cler) {
 				int v; //TODO just use last_index.
 				if(split & (1<<k)) {
 					v = index.bitstream.read(splitbits);
+					out.split(v);
 				} else {
-					assert(vertex_count < index.prediction.size());
-					index.prediction[vertex_count] = Face(last_index, last_index, last_index);
+					assert(vertex_count < nvert);
+					predict(vertex_count, last_index, last_index, last_index);
 					last_index = v = vertex_count++;
 				}
 				vindex[k] = v;
-				if(index.faces16)
-					index.faces16[start++] = v;
-				else
-					index.faces32[start++] = v;
+				out.write(start++, v);
 			}
 			int current_edge = front.size();
 			faceorder.push_back(front.size());
@@ -294,9 +553,10 @@ void Decoder::decodeFaces(uint32_t start, uint32_t end, uint32_t &cler) {
 		if(c == VERTEX || c == SPLIT) {
 			if(c == SPLIT) {
 				opposite = index.bitstream.read(splitbits);
+				out.split(opposite);
 			} else {
 				//Edge is inverted respect to encoding hence v1-v0 inverted.
-				index.prediction[vertex_count] = Face(v1, v0, e.v2);
+				predict(vertex_count, v1, v0, e.v2);
 				opposite = vertex_count++;
 			}
 			assert(opposite < nvert);
@@ -345,14 +605,8 @@ void Decoder::decodeFaces(uint32_t start, uint32_t end, uint32_t &cler) {
 		assert(v1 != opposite);
 		assert(v0 != opposite);
 
-		if(index.faces16) {
-			index.faces16[start++] = v1;
-			index.faces16[start++] = v0;
-			index.faces16[start++] = opposite;
-		} else {
-			index.faces32[start++] = v1;
-			index.faces32[start++] = v0;
-			index.faces32[start++] = opposite;
-		}
+		out.write(start++, v1);
+		out.write(start++, v0);
+		out.write(start++, opposite);
 	}
 }
@@ -24,13 +24,14 @@ If not, see <http://www.gnu.org/licenses/>.
 #include "zpoint.h"
 #include "tunstall.h"
 #include "encoder.h"
+#include "workers.h"
 
 using namespace crt;
 using namespace std;
 
 Encoder::Encoder(uint32_t _nvert, uint32_t _nface, Stream::Entropy entropy):
 	nvert(_nvert), nface(_nface),
-	header_size(0), current_vertex(0), last_index(0) {
+	header_size(0), version(1), threads(1), progressive(false), merge(NO_MERGE), merged(0), current_vertex(0), last_index(0) {
 
 	stream.entropy = entropy;
 	index.faces.resize(nface*3);
@@ -191,6 +192,7 @@ bool Encoder::addAttribute(const char *name, const char *buffer, VertexAttribute
 	attr->q = q;
 	attr->strategy = strategy;
 	attr->format = format;
+	attr->threads = threads;
 	attr->quantize(nvert, (char *)buffer);
 	data[name] = attr;
 	return true;
@@ -198,6 +200,7 @@ bool Encoder::addAttribute(const char *name, const char *buffer, VertexAttribute
 //whatever is inside is your job to fill attr variables.
 bool Encoder::addAttribute(const char *name, char *buffer, VertexAttribute *attr) {
 	if(data.count(name)) return true;
+	attr->threads = threads;
 	attr->quantize(nvert, buffer);
 	data[name] = attr;
 	return true;
@@ -206,9 +209,10 @@ bool Encoder::addAttribute(const char *name, char *buffer, VertexAttribute *attr
 
 void Encoder::encode() {
 	stream.reserve(nvert);
+	stream.threads = threads;
 
 	stream.write<uint32_t>(0x787A6300);
-	stream.write<uint32_t>(0x1); //version
+	stream.write<uint32_t>(version);
 	stream.write<uchar>(stream.entropy);
 
 	stream.write<uint32_t>(exif.size());
@@ -219,6 +223,7 @@ void Encoder::encode() {
 
 	stream.write<int>(data.size());
 	for(auto it: data) {
+		it.second->threads = threads;
 		stream.writeString(it.first.c_str());                //name
 		stream.write<int>(it.second->codec());
 		stream.write<float>(it.second->q);
@@ -231,9 +236,49 @@ void Encoder::encode() {
 		encodeMesh();
 	else
 		encodePointCloud();
+	stream.flush();
 }
 
 
+//stable reorder of morton sorted points by the depth of the first octree cell they are the first point of:
+//level d holds one point for each cell of depth d, the last level the duplicated points.
+//high: keys of the levels above 21 (if any) aligned with points.
+static void levelSort(std::vector<ZPoint> &points, std::vector<ZPoint> &high, std::vector<Group> &groups, int threads) {
+	uint32_t n = points.size();
+	int top = high.size()? 11 : 0;
+	int nlevels = top + 23;
+	std::vector<uchar> levels(n);
+	parallelFor(threads, n, [&](uint32_t start, uint32_t end) {
+		for(uint32_t i = std::max<uint32_t>(start, 1); i < end; i++) {
+			uint64_t differ = top? high[i-1].bits ^ high[i].bits : 0;
+			if(differ) {
+				levels[i] = 11 - ilog2(differ)/3;
+				continue;
+			}
+			differ = points[i-1].bits ^ points[i].bits;
+			levels[i] = top + (differ? 21 - ilog2(differ)/3 : 22);
+		}
+	});
+	if(n) levels[0] = 0;
+
+	std::vector<uint32_t> offsets(nlevels + 1, 0);
+	for(uchar l: levels)
+		offsets[l + 1]++;
+	groups.clear();
+	for(int l = 0; l < nlevels; l++) {
+		offsets[l + 1] += offsets[l];
+		if(offsets[l + 1] == offsets[l])
+			continue;
+		Group g(offsets[l + 1]);
+		g.properties["depth"] = std::to_string(l);
+		groups.push_back(g);
+	}
+	std::vector<ZPoint> sorted(n);
+	for(uint32_t i = 0; i < n; i++)
+		sorted[offsets[levels[i]]++] = points[i];
+	points.swap(sorted);
+}
+
 //TODO: test pointclouds
 void Encoder::encodePointCloud() {
 	//look for positions
@@ -250,35 +295,85 @@ void Encoder::encodePointCloud() {
 
 	std::vector<ZPoint> zpoints(nvert);
 
-	Point3i min(0, 0, 0);
+	Point3i min(0, 0, 0), max(0, 0, 0);
+	if(nvert)
+		min = max = coords[0];
 	for(uint32_t i = 0; i < nvert; i++) {
 		Point3i &q = coords[i];
 		min.setMin(q);
+		max.setMax(q);
 	}
-	for(uint32_t i = 0; i < nvert; i++) {
-		Point3i q = coords[i] - min;
-		zpoints[i] = ZPoint(q[0], q[1], q[2], 21, i);
+	//offset from min, unsigned: the span of int coordinates needs up to 32 bits.
+	auto offset = [&](uint32_t i, int k) { return (uint64_t)((uint32_t)coords[i][k] - (uint32_t)min[k]); };
+	uint32_t span = 0;
+	for(int k = 0; k < 3; k++)
+		span = std::max(span, (uint32_t)max[k] - (uint32_t)min[k]);
+
+	parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+		for(uint32_t i = start; i < end; i++)
+			zpoints[i] = ZPoint(offset(i, 0), offset(i, 1), offset(i, 2), 21, i);
+	});
+	radixSort(zpoints, threads);
+
+	//above 21 bits the key has two levels: the sort is stable, sorting by the high bits keeps the order of the low ones.
+	std::vector<ZPoint> high;
+	if(span >> 21) {
+		high.resize(nvert);
+		parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+			for(uint32_t i = start; i < end; i++) {
+				uint32_t p = zpoints[i].pos;
+				high[i] = ZPoint(offset(p, 0) >> 21, offset(p, 1) >> 21, offset(p, 2) >> 21, 11, i);
+			}
+		});
+		radixSort(high, threads);
+		std::vector<ZPoint> sorted(nvert);
+		parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+			for(uint32_t i = start; i < end; i++)
+				sorted[i] = zpoints[high[i].pos];
+		});
+		zpoints.swap(sorted);
 	}
-	sort(zpoints.rbegin(), zpoints.rend());//, greater<ZPoint>());
-
-	//remove duplicated points.
-	/*int count = 0;
-	for(unsigned int i = 1; i < nvert; i++) {
-		if(zpoints[i] == zpoints[count])
-			continue;
-		count++;
-		zpoints[count] = zpoints[i];
+	//equal keys are adjacent and the sort is stable: each run is merged into its first point in input order.
+	std::vector<uint32_t> owner; //kept point of each input point.
+	if(merge) {
+		owner.resize(nvert);
+		std::vector<uint32_t> run;
+		uint32_t count = 0;
+		for(uint32_t i = 0; i < nvert; ) {
+			uint32_t j = i + 1;
+			while(j < nvert && zpoints[j] == zpoints[i] && (!high.size() || high[j] == high[i]))
+				j++;
+			run.clear();
+			for(uint32_t k = i; k < j; k++) {
+				owner[zpoints[k].pos] = zpoints[i].pos;
+				run.push_back(zpoints[k].pos);
+			}
+			if(merge == MERGE_AVERAGE && run.size() > 1)
+				for(auto it: data)
+					if(it.first != "position")
+						it.second->merge(run.data(), run.size());
+			zpoints[count] = zpoints[i];
+			if(high.size())
+				high[count] = high[i];
+			count++;
+			i = j;
+		}
+		merged = nvert - count;
+		zpoints.resize(count);
+		if(high.size())
+			high.resize(count);
 	}
-	count++;
-	nvert = count; */
-	zpoints.resize(nvert);
 
-	header_size = stream.elapsed();
+	if(progressive)
+		levelSort(zpoints, high, index.groups, threads);
 
-	stream.write<uint32_t>(nvert);
-	stream.write<uint32_t>(0); //nface
-
-	index.encodeGroups(stream);
+	remap.resize(nvert);
+	for(uint32_t i = 0; i < zpoints.size(); i++)
+		remap[zpoints[i].pos] = i;
+	if(merged)
+		for(uint32_t i = 0; i < nvert; i++)
+			remap[i] = remap[owner[i]];
+	nvert = zpoints.size();
 
 	prediction.resize(nvert);
 	prediction[0] = Quad(zpoints[0].pos, -1, -1, -1);
@@ -291,8 +386,12 @@ void Encoder::encodePointCloud() {
 	for(auto it: data)
 		it.second->deltaEncode(prediction);
 
-	for(auto it: data)
-		it.second->encode(nvert, stream);
+	header_size = stream.elapsed();
+
+	stream.write<uint32_t>(nvert);
+	stream.write<uint32_t>(0); //nface
+
+	encodeStreams();
 }
 
 /*	Zpoint encoding gain 1 bit (because we know it's sorted, but it's 3/2 slower and limited to 22 bits precision.
@@ -372,12 +471,65 @@ void Encoder::encodeMesh() {
 	stream.write<int>(nvert);
 	stream.write<int>(nface);
 	header_size = stream.elapsed();
+
+	encodeStreams();
+}
+
+//groups, index and attributes. Version 2 prepends offset and length of each substream (index first).
+void Encoder::encodeStreams() {
+	size_t table = stream.size();
+	uint32_t nstreams = data.size() + 1;
+	if(version > 1)
+		stream.grow(nstreams*2*sizeof(uint32_t));
+
 	index.encodeGroups(stream);
-	index.encode(stream);
 
-	for(auto it: data)
-		it.second->encode(nvert, stream);
+	std::vector<uint32_t> offsets;
+#ifndef NO_THREADS
+	if(threads > 1) {
+		//each substream is encoded on its own on worker threads, then appended in the same order.
+		std::vector<VertexAttribute *> attrs;
+		for(auto it: data)
+			attrs.push_back(it.second);
+		std::vector<OutStream> parts(nstreams);
+		//the parts running together share the threads for their components.
+		int running = std::min<int>(threads, (int)nstreams);
+		Workers workers;
+		workers.start(running, nstreams, [&](size_t i) {
+			OutStream &part = parts[i];
+			part.entropy = stream.entropy;
+			part.threads = std::max(1, threads/running);
+			if(i == 0) {
+				if(nface > 0)
+					index.encode(part);
+			} else
+				attrs[i - 1]->encode(nvert, part);
+		});
+		workers.join();
+		for(OutStream &part: parts) {
+			offsets.push_back(OutStream::offset32(stream.size()));
+			stream.append(part);
+		}
+	} else
+#endif
+	{
+		offsets.push_back(OutStream::offset32(stream.size()));
+		if(nface > 0)
+			index.encode(stream);
+
+		for(auto it: data) {
+			offsets.push_back(OutStream::offset32(stream.size()));
+			it.second->encode(nvert, stream);
+		}
+	}
+	offsets.push_back(OutStream::offset32(stream.size()));
 
+	if(version > 1) {
+		for(uint32_t i = 0; i < nstreams; i++) {
+			stream.rewrite<uint32_t>(table + i*8, offsets[i]);
+			stream.rewrite<uint32_t>(table + i*8 + 4, offsets[i+1] - offsets[i]);
+		}
+	}
 }
 
 class McFace {
@@ -20,6 +20,9 @@ SOURCES += main.cpp \
     cstream.cpp \
     color_attribute.cpp \
     normal_attribute.cpp \
+    simd.cpp \
+    tiles.cpp \
+    mappedfile.cpp \
     tinyply.cpp \
     meshloader.cpp
 
@@ -27,6 +30,10 @@ HEADERS += \
     ../include/corto/decoder.h \
     ../include/corto/encoder.h \
     ../include/corto/point.h \
+    ../include/corto/simd.h \
+    ../include/corto/tiles.h \
+    ../include/corto/mappedfile.h \
+    ../include/corto/workers.h \
     ../include/corto/zpoint.h \
     ../include/corto/cstream.h \
     ../include/corto/tunstall.h \
@@ -52,6 +52,10 @@ FILE is the path to a .ply or a .obj 3D model.
 			   if not specified the extension of the input file will be replaced.
   -e <key=value>: add an exif property, or more than one.
   -p : treat the input as a point cloud."
+  -l : point clouds ordered by octree level: decoding a prefix gives a subsampled cloud.
+  -d <merge>: point clouds duplicated coords after quantization are removed, attributes can be:
+	  first: keep the attributes of the first point
+	  average: average the attributes of the merged points
   -v <bits>: vertex bits quantization. If not specified an euristic is used
   -n <bits>: normal bits quantization. Default 10.
   -c <bits>: color bits quantization. Default 6.
@@ -63,6 +67,8 @@ FILE is the path to a .ply or a .obj 3D model.
 	  border: store difference only for boundary vertices (smaller, inaccurate)
   -P <file.ply>: decompress and save as .ply for debugging purpouses
   -G <group>: extract only a group in obj
+  -t <threads>: number of threads used. Default 1.
+  -V <version>: crt format version. Default 1, 2 adds a table of substreams offsets (needs recent decoders).
 )use";
 }
 
@@ -76,6 +82,8 @@ int main(int argc, char *argv[]) {
 	string plyfile;
 	string group;
 	bool pointcloud = false;
+	bool progressive = false;
+	string merge;
 	bool add_normals = false;
 	float vertex_q = 0.0f;
 	int vertex_bits = 0;
@@ -85,15 +93,19 @@ int main(int argc, char *argv[]) {
 	int b_bits = 6;
 	int a_bits = 5;
 	int uv_bits = 12;
+	int threads = 1;
+	int version = 1;
 
 	string normal_prediction;
 	std::map<std::string, std::string> exif;
 
 	int c;
-	while((c = getopt(argc, argv, "pAo:v:n:c:u:q:N:e:P:G:")) != -1) {
+	while((c = getopt(argc, argv, "plAo:v:n:c:u:q:N:e:P:G:t:d:V:")) != -1) {
 		switch(c) {
 		case 'o': output = optarg;  break;  //output filename
 		case 'p': pointcloud = true; break; //force pointcloud
+		case 'l': progressive = true; break;
+		case 'd': merge = optarg; break;
 		case 'v': vertex_bits = atoi(optarg); break;
 		case 'n': norm_bits   = atoi(optarg); break;
 		case 'c': r_bits = g_bits = a_bits = b_bits  = atoi(optarg); break;
@@ -108,6 +120,8 @@ int main(int argc, char *argv[]) {
 		case 'N': normal_prediction = optarg; break;
 		case 'P': plyfile = optarg; break; //save ply for debugging purpouses
 		case 'G': group = optarg; break;
+		case 't': threads = atoi(optarg); break;
+		case 'V': version = atoi(optarg); break;
 		case 'e': {
 			std::string opt(optarg);
 			size_t pos = opt.find('=');
@@ -145,16 +159,37 @@ int main(int argc, char *argv[]) {
 	}
 	input = argv[optind];
 
+	//checked before the output file is created.
+	if(version < 1 || version > 2) {
+		cerr << "Unknown version: " << version << " expecting 1 or 2" << endl;
+		return 1;
+	}
+	crt::Encoder::Merge merge_mode = crt::Encoder::NO_MERGE;
+	if(merge == "first")
+		merge_mode = crt::Encoder::MERGE_FIRST;
+	else if(merge == "average")
+		merge_mode = crt::Encoder::MERGE_AVERAGE;
+	else if(!merge.empty()) {
+		cerr << "Unknown merge: " << merge << " expecting: first or average" << endl;
+		return 1;
+	}
+
 	//options for obj: join by material (discard group info).
 	//exif pairs: -exif key=value //write and override what would put inside (mtllib for example).
 
+	crt::Timer load_timer;
 	crt::MeshLoader loader;
 	loader.add_normals = add_normals;
+	loader.threads = threads;
 	bool ok = loader.load(input, group);
 	if(!ok) {
 		cerr << "Failed loading model: " << input << endl;
 		return 1;
 	}
+	int64_t load_time = load_timer.elapsed();
+	std::ifstream loaded(input, std::ios::binary | std::ios::ate);
+	double megabytes = loaded? loaded.tellg()/(1024.0*1024.0) : 0.0;
+	cout << "Loading time: " << load_time << "ms (" << megabytes*1000.0/std::max<int64_t>(load_time, 1) << " MB/s)" << endl;
 
 	if(pointcloud)
 		loader.nface = 0;
@@ -174,9 +209,29 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	if(output.empty()) {
+		size_t lastindex = input.find_last_of(".");
+		output = input.substr(0, lastindex);
+	}
+	if(!endsWith(output, ".crt"))
+		output += ".crt";
+
+	FILE *file = fopen(output.c_str(), "wb");
+	if(!file) {
+		cerr << "Couldl not open file: " << output << endl;
+		return 1;
+	}
+
 	crt::Timer timer;
 
 	crt::Encoder encoder(loader.nvert, loader.nface, crt::Stream::TUNSTALL);
+	//the stream is written to the file while encoding.
+	crt::FileSink sink(file);
+	encoder.stream.setSink(&sink);
+	encoder.threads = threads;
+	encoder.version = version;
+	encoder.progressive = progressive;
+	encoder.merge = merge_mode;
 
 	encoder.exif = loader.exif;
 	//add and override exif properties
@@ -215,7 +270,10 @@ int main(int argc, char *argv[]) {
 	if(loader.radiuses.size())
 		encoder.addAttribute("radius", (char *)loader.radiuses.data(), crt::VertexAttribute::FLOAT, 1, 1.0f);
 	encoder.encode();
-
+	if(fclose(file) != 0 || sink.failed) {
+		cerr << "Failed saving file: " << output << endl;
+		return 1;
+	}
 
 	cout << "Encoding time: " << timer.elapsed() << "ms" << endl;
 
@@ -224,6 +282,8 @@ int main(int argc, char *argv[]) {
 	uint32_t nface = encoder.nface;
 
 	cout << "Nvert: " << nvert << " Nface: " << nface << endl;
+	if(encoder.merged)
+		cout << "Merged duplicated points: " << encoder.merged << endl;
 	cout << "Compressed to: " << encoder.stream.size() << endl;
 	cout << "Ratio: " << 100.0f*encoder.stream.size()/(nvert*12 + nface*12) << "%" << endl;
 	cout << "Bpv: " << 8.0f*encoder.stream.size()/nvert << endl << endl;
@@ -265,7 +325,8 @@ int main(int argc, char *argv[]) {
 
 	timer.start();
 
-	crt::Decoder decoder(encoder.stream.size(), encoder.stream.data());
+	crt::Decoder decoder(output.c_str());
+	decoder.threads = threads;
 	assert(decoder.nface == nface);
 	assert(decoder.nvert == nvert);
 
@@ -306,24 +367,6 @@ int main(int argc, char *argv[]) {
 		cout << "TOT M verts: " << mverts << " in: " << delta << "ms, " << 1000*mverts/delta << " MT/s" << endl;
 	}
 
-	if(output.empty()) {
-		size_t lastindex = input.find_last_of(".");
-		output = input.substr(0, lastindex);
-	}
-	if(!endsWith(output, ".crt"))
-		output += ".crt";
-
-	FILE *file = fopen(output.c_str(), "wb");
-	if(!file) {
-		cerr << "Couldl not open file: " << output << endl;
-		return 1;
-	}
-	size_t count = encoder.stream.size();
-	size_t written = fwrite ( encoder.stream.data(), 1, count, file);
-	if(written != count) {
-		cerr << "Failed saving file: " << "test.crt" << endl;
-		return 1;
-	}
 	std::vector<std::string> comments;
 	if(!plyfile.empty())
 		out.savePly(plyfile, comments);
@@ -0,0 +1,219 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef _WIN32
+#define NOMINMAX //std::min and std::max here and in cstream.h
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+using namespace crt;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(): buffer(nullptr), length(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+
+bool MappedFile::open(const char *filename) {
+	close();
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping) {
+		close();
+		return false;
+	}
+	buffer = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!buffer) {
+		close();
+		return false;
+	}
+	length = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if(buffer)
+		UnmapViewOfFile(buffer);
+	if(mapping)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	buffer = nullptr;
+	length = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+
+MappedSink::MappedSink(): buffer(nullptr), length(0), capacity(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+
+bool MappedSink::open(const char *filename) {
+	close();
+	failed = false;
+	file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return file != INVALID_HANDLE_VALUE;
+}
+
+void MappedSink::unmap() {
+	if(buffer)
+		UnmapViewOfFile(buffer);
+	if(mapping)
+		CloseHandle(mapping);
+	buffer = nullptr;
+	mapping = nullptr;
+	capacity = 0;
+}
+
+//the size of the mapping extends the file.
+bool MappedSink::reserve(size_t size) {
+	unmap();
+	LARGE_INTEGER s;
+	s.QuadPart = (LONGLONG)size;
+	mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, s.HighPart, s.LowPart, NULL);
+	if(!mapping)
+		return false;
+	buffer = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+	if(!buffer)
+		return false;
+	capacity = size;
+	return true;
+}
+
+void MappedSink::close() {
+	unmap();
+	if(file != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER s;
+		s.QuadPart = (LONGLONG)length;
+		if(!SetFilePointerEx(file, s, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+			failed = true;
+		CloseHandle(file);
+	}
+	file = INVALID_HANDLE_VALUE;
+	length = 0;
+}
+
+#else
+
+MappedFile::MappedFile(): buffer(nullptr), length(0), fd(-1) {}
+
+bool MappedFile::open(const char *filename) {
+	close();
+	fd = ::open(filename, O_RDONLY);
+	if(fd == -1)
+		return false;
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0) {
+		close();
+		return false;
+	}
+	void *map = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) {
+		close();
+		return false;
+	}
+	madvise(map, (size_t)info.st_size, MADV_SEQUENTIAL);
+	buffer = (const unsigned char *)map;
+	length = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if(buffer)
+		munmap((void *)buffer, length);
+	if(fd != -1)
+		::close(fd);
+	buffer = nullptr;
+	length = 0;
+	fd = -1;
+}
+
+MappedSink::MappedSink(): buffer(nullptr), length(0), capacity(0), fd(-1) {}
+
+bool MappedSink::open(const char *filename) {
+	close();
+	failed = false;
+	fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	return fd != -1;
+}
+
+void MappedSink::unmap() {
+	if(buffer)
+		munmap(buffer, capacity);
+	buffer = nullptr;
+	capacity = 0;
+}
+
+bool MappedSink::reserve(size_t size) {
+	unmap();
+	if(ftruncate(fd, (off_t)size) != 0)
+		return false;
+	void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return false;
+	buffer = (unsigned char *)map;
+	capacity = size;
+	return true;
+}
+
+void MappedSink::close() {
+	unmap();
+	if(fd != -1) {
+		if(ftruncate(fd, (off_t)length) != 0)
+			failed = true;
+		::close(fd);
+	}
+	fd = -1;
+	length = 0;
+}
+
+#endif
+
+//remapping copies nothing: the capacity doubles to keep the remaps few.
+void MappedSink::write(const uchar *data, size_t size) {
+	if(failed)
+		return;
+	if(length + size > capacity && !reserve(std::max(length + size, std::max(2*capacity, (size_t)1<<24)))) {
+		failed = true;
+		return;
+	}
+	memcpy(buffer + length, data, size);
+	length += size;
+}
+
+//only bytes already written.
+void MappedSink::rewrite(size_t offset, const uchar *data, size_t size) {
+	if(failed)
+		return;
+	if(offset > length || size > length - offset) {
+		failed = true;
+		return;
+	}
+	memcpy(buffer + offset, data, size);
+}
@@ -17,11 +17,17 @@ If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <assert.h>
+#include <string.h>
+#include <sstream>
+#include <atomic>
 
 #include "meshloader.h"
 #include "tinyply.h"
 #include "objload.h"
 #include "point.h"
+#include "normal_attribute.h"
+#include "mappedfile.h"
+#include "workers.h"
 
 using namespace crt;
 using namespace tinyply;
@@ -45,30 +51,271 @@ bool MeshLoader::load(const std::string &filename, const string &group) {
 }
 
 
-bool MeshLoader::loadPly(const std::string &filename) {
-	std::ifstream ss(filename, std::ios::binary);
-	if(!ss.is_open())
+namespace {
+
+struct RawPlyProperty {
+	std::string name;
+	std::string type;
+	uint32_t offset; //in the record, lists assume 3 items.
+	std::string count_type; //lists only
+};
+
+struct RawPlyElement {
+	std::string name;
+	uint64_t count;
+	uint32_t stride;
+	std::vector<RawPlyProperty> properties;
+	const RawPlyProperty *find(const std::string &name) const {
+		for(const RawPlyProperty &p: properties)
+			if(p.name == name)
+				return &p;
+		return nullptr;
+	}
+};
+
+//float or double property copied to component k of n of a float array, uchar or char to a byte array.
+struct RawPlyField {
+	uint32_t offset;
+	std::string type;
+	float *floats;
+	uint8_t *bytes;
+	int n, k;
+};
+
+}
+
+static uint32_t plyTypeBytes(const std::string &type) {
+	if(type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+	if(type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+	if(type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32") return 4;
+	if(type == "double" || type == "float64") return 8;
+	return 0;
+}
+
+//add the fields for the properties names, all present and of a supported type, resizing values to n*nvert.
+template <class T> static bool plyFields(const RawPlyElement &vertex, std::vector<std::string> names, std::vector<T> &values, std::vector<RawPlyField> &fields) {
+	std::vector<const RawPlyProperty *> found;
+	for(const std::string &name: names)
+		if(const RawPlyProperty *p = vertex.find(name))
+			found.push_back(p);
+	if(found.size() != names.size())
 		return false;
-	PlyFile ply(ss);
+	int n = (int)names.size();
+	values.resize(vertex.count*n);
+	for(int k = 0; k < n; k++) {
+		RawPlyField f = { found[k]->offset, found[k]->type, nullptr, nullptr, n, k };
+		if(sizeof(T) == 1)
+			f.bytes = (uint8_t *)values.data();
+		else
+			f.floats = (float *)values.data();
+		fields.push_back(f);
+	}
+	return true;
+}
 
-	ply.request_properties_from_element("vertex", { "x", "y", "z" }, coords);
-	ply.request_properties_from_element("vertex", { "nx", "ny", "nz" }, norms);
-	ply.request_properties_from_element("vertex", { "red", "green", "blue", "alpha" }, colors);
-	ply.request_properties_from_element("vertex", { "texture_u", "texture_v" }, uvs);
-	if(uvs.empty())
-		ply.request_properties_from_element("vertex", { "s", "t" }, uvs);
-	if(uvs.empty())
-	ply.request_properties_from_element("vertex", { "u", "v" }, uvs);
+template <class T> static T plyRead(const uchar *p) {
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
 
-	ply.request_properties_from_element("vertex", { "radius" }, radiuses);
+bool MeshLoader::loadPlyMapped(const std::string &filename, std::vector<std::string> &comments) {
+	const uint16_t one = 1;
+	if(*(const uchar *)&one != 1) //big endian host
+		return false;
 
-	ply.request_properties_from_element("face", { "vertex_index" }, index, 3);
-	if(index.empty())
-		ply.request_properties_from_element("face", { "vertex_indices" }, index, 3);
-	ply.request_properties_from_element("face", { "texcoord" }, wedge_uvs, 6);
-	ply.request_properties_from_element("face", { "texnumber" }, tex_number, 1);
+	MappedFile file;
+	if(!file.open(filename.c_str()))
+		return false;
+	const char *text = (const char *)file.data();
+	size_t header_size = 0;
+	const char *end_header = "end_header";
+	for(size_t i = 0; i + 10 < file.size() && i < (1<<20); i++) {
+		if(text[i] == '\n' && !strncmp(text + i + 1, end_header, 10)) {
+			header_size = i + 11;
+			break;
+		}
+	}
+	while(header_size && header_size < file.size() && text[header_size] != '\n')
+		header_size++;
+	if(!header_size || header_size >= file.size())
+		return false;
+	header_size++;
+
+	std::vector<RawPlyElement> elements;
+	std::istringstream header(std::string(text, header_size));
+	std::string line;
+	bool binary = false;
+	while(std::getline(header, line)) {
+		if(line.size() && line.back() == '\r')
+			line.pop_back();
+		std::istringstream words(line);
+		std::string key;
+		words >> key;
+		if(key == "format") {
+			std::string format;
+			words >> format;
+			binary = format == "binary_little_endian";
+		} else if(key == "comment" || key == "obj_info") {
+			if(key == "comment")
+				comments.push_back(line.size() > 8? line.substr(8) : std::string());
+		} else if(key == "element") {
+			RawPlyElement e;
+			words >> e.name >> e.count;
+			e.stride = 0;
+			elements.push_back(e);
+		} else if(key == "property") {
+			if(!elements.size())
+				return false;
+			RawPlyElement &e = elements.back();
+			RawPlyProperty p;
+			words >> p.type;
+			if(p.type == "list") {
+				words >> p.count_type >> p.type;
+				if(plyTypeBytes(p.count_type) != 1)
+					return false;
+			}
+			words >> p.name;
+			uint32_t bytes = plyTypeBytes(p.type);
+			if(!bytes)
+				return false;
+			p.offset = e.stride;
+			e.stride += p.count_type.size()? 1 + 3*bytes : bytes;
+			e.properties.push_back(p);
+		}
+	}
+	if(!binary)
+		return false;
 
-	ply.read(ss);
+	//vertices and faces of triangles only, other elements without lists are skipped.
+	const RawPlyElement *vertex = nullptr, *face = nullptr;
+	const RawPlyProperty *indices = nullptr;
+	const uchar *vertex_data = nullptr, *face_data = nullptr;
+	size_t offset = header_size;
+	for(const RawPlyElement &e: elements) {
+		if(e.count >= (1ull<<32))
+			return false;
+		if(e.name == "vertex") {
+			vertex = &e;
+			vertex_data = file.data() + offset;
+		} else if(e.name == "face") {
+			face = &e;
+			face_data = file.data() + offset;
+			for(const RawPlyProperty &p: e.properties) {
+				if(p.name == "texcoord" || p.name == "texnumber")
+					return false;
+				if(p.name == "vertex_index" || p.name == "vertex_indices")
+					indices = &p;
+				else if(p.count_type.size())
+					return false;
+			}
+			if(e.count && (!indices || plyTypeBytes(indices->type) != 4))
+				return false;
+		}
+		for(const RawPlyProperty &p: e.properties)
+			if(p.count_type.size() && &e != face)
+				return false;
+		offset += e.count*e.stride;
+	}
+	if(!vertex || offset > file.size())
+		return false;
+
+	//same properties requested to tinyply.
+	std::vector<float> _coords, _norms, _uvs, _radiuses;
+	std::vector<uint8_t> _colors;
+	std::vector<RawPlyField> fields;
+	if(!plyFields(*vertex, { "x", "y", "z" }, _coords, fields))
+		return false;
+	plyFields(*vertex, { "nx", "ny", "nz" }, _norms, fields);
+	if(!plyFields(*vertex, { "red", "green", "blue", "alpha" }, _colors, fields))
+		plyFields(*vertex, { "red", "green", "blue" }, _colors, fields);
+	if(!plyFields(*vertex, { "texture_u", "texture_v" }, _uvs, fields) &&
+			!plyFields(*vertex, { "s", "t" }, _uvs, fields))
+		plyFields(*vertex, { "u", "v" }, _uvs, fields);
+	plyFields(*vertex, { "radius" }, _radiuses, fields);
+	for(const RawPlyField &f: fields) {
+		bool byte = plyTypeBytes(f.type) == 1;
+		bool real = f.type == "float" || f.type == "float32" || plyTypeBytes(f.type) == 8;
+		if(f.bytes? !byte : !real)
+			return false;
+	}
+
+	uint32_t _nvert = (uint32_t)vertex->count;
+	parallelFor(threads, _nvert, [&](uint32_t start, uint32_t end) {
+		for(const RawPlyField &f: fields) {
+			const uchar *record = vertex_data + (size_t)start*vertex->stride + f.offset;
+			if(f.bytes)
+				for(uint32_t i = start; i < end; i++, record += vertex->stride)
+					f.bytes[(size_t)i*f.n + f.k] = *record;
+			else if(plyTypeBytes(f.type) == 8)
+				for(uint32_t i = start; i < end; i++, record += vertex->stride)
+					f.floats[(size_t)i*f.n + f.k] = (float)plyRead<double>(record);
+			else
+				for(uint32_t i = start; i < end; i++, record += vertex->stride)
+					f.floats[(size_t)i*f.n + f.k] = plyRead<float>(record);
+		}
+	});
+
+	std::vector<uint32_t> _index;
+	if(face && face->count) {
+		uint32_t _nface = (uint32_t)face->count;
+		_index.resize((size_t)_nface*3);
+		std::vector<uint32_t> bounds = splitRanges(_nface, threads);
+		std::vector<uchar> triangles(bounds.size() - 1, 1);
+		forRanges(bounds, [&](size_t t) {
+			const uchar *record = face_data + (size_t)bounds[t]*face->stride + indices->offset;
+			for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++, record += face->stride) {
+				if(*record != 3) {
+					triangles[t] = 0;
+					return;
+				}
+				for(int k = 0; k < 3; k++)
+					_index[(size_t)i*3 + k] = plyRead<uint32_t>(record + 1 + 4*k);
+			}
+		});
+		for(uchar ok: triangles)
+			if(!ok)
+				return false;
+	}
+
+	swap(coords, _coords);
+	swap(norms, _norms);
+	swap(colors, _colors);
+	swap(uvs, _uvs);
+	swap(radiuses, _radiuses);
+	swap(index, _index);
+	return true;
+}
+
+bool MeshLoader::loadPly(const std::string &filename) {
+	std::vector<std::string> comments;
+	if(!loadPlyMapped(filename, comments)) {
+		comments.clear();
+		std::ifstream ss(filename, std::ios::binary);
+		if(!ss.is_open())
+			return false;
+		PlyFile ply(ss);
+
+		ply.request_properties_from_element("vertex", { "x", "y", "z" }, coords);
+		ply.request_properties_from_element("vertex", { "nx", "ny", "nz" }, norms);
+		ply.request_properties_from_element("vertex", { "red", "green", "blue", "alpha" }, colors);
+		ply.request_properties_from_element("vertex", { "texture_u", "texture_v" }, uvs);
+		if(uvs.empty())
+			ply.request_properties_from_element("vertex", { "s", "t" }, uvs);
+		if(uvs.empty())
+		ply.request_properties_from_element("vertex", { "u", "v" }, uvs);
+
+		ply.request_properties_from_element("vertex", { "radius" }, radiuses);
+
+		ply.request_properties_from_element("face", { "vertex_index" }, index, 3);
+		if(index.empty())
+			ply.request_properties_from_element("face", { "vertex_indices" }, index, 3);
+		ply.request_properties_from_element("face", { "texcoord" }, wedge_uvs, 6);
+		ply.request_properties_from_element("face", { "texnumber" }, tex_number, 1);
+
+		ply.read(ss);
+		comments = ply.comments;
+	}
 
 	nface = index.size()/3;
 	nvert = coords.size()/3;
@@ -122,16 +369,294 @@ bool MeshLoader::loadPly(const std::string &filename) {
 	}
 
 	uint32_t texcount = 0;
-	for(auto &str: ply.comments)
+	for(auto &str: comments)
 		if(startsWith(str, "TextureFile") && texcount < groups.size())
 			groups[texcount++].properties["texture"] = str.substr(12, str.size());
 
 	return true;
 }
 
+//decimal floats with optional sign, fraction and exponent, anything else (nan, inf, hex) goes to strtod.
+static const char *parseFloat(const char *p, const char *end, float &value) {
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+									 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *start = p;
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for(; p < end && *p >= '0' && *p <= '9'; p++) {
+		any = true;
+		if(digits < 19) {
+			mantissa = mantissa*10 + (*p - '0');
+			digits += mantissa != 0;
+		} else
+			exponent++;
+	}
+	if(p < end && *p == '.') {
+		for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			any = true;
+			if(digits < 19) {
+				mantissa = mantissa*10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	bool valid = any;
+	if(valid && p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool minus = false;
+		if(p < end && (*p == '-' || *p == '+'))
+			minus = *p++ == '-';
+		int e = 0;
+		valid = p < end && *p >= '0' && *p <= '9';
+		for(; p < end && *p >= '0' && *p <= '9'; p++)
+			e = std::min(e*10 + (*p - '0'), 10000);
+		exponent += minus? -e : e;
+	}
+	if(valid && (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+		double v = (double)mantissa;
+		if(exponent < 0)
+			v = exponent >= -22? v/powers[-exponent] : v*pow(10.0, exponent);
+		else if(exponent > 0)
+			v = exponent <= 22? v*powers[exponent] : v*pow(10.0, exponent);
+		value = (float)(negative? -v : v);
+		return p;
+	}
+	char token[64];
+	size_t length = 0;
+	for(p = start; p < end && length < 63 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'; p++)
+		token[length++] = *p;
+	token[length] = 0;
+	char *last;
+	value = (float)strtod(token, &last);
+	return start + (last - token);
+}
+
+static const char *parseInt(const char *p, const char *end, int &value, bool &ok) {
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	ok = p < end && *p >= '0' && *p <= '9';
+	int64_t v = 0;
+	for(; p < end && *p >= '0' && *p <= '9'; p++)
+		v = std::min<int64_t>(v*10 + (*p - '0'), INT32_MAX);
+	value = (int)(negative? -v : v);
+	return p;
+}
+
+static const char *skipSpaces(const char *p, const char *end) {
+	while(p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+//whitespace separated word, empty at the end of the line.
+static std::string parseWord(const char *&p, const char *end) {
+	p = skipSpaces(p, end);
+	const char *start = p;
+	while(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+		p++;
+	return std::string(start, p);
+}
+
+namespace {
+
+//g, usemtl and mtllib lines: replayed in order when merging, face is the number of faces before them.
+struct ObjEvent {
+	char type;
+	uint32_t face;
+	std::vector<std::string> words;
+};
+
+//parsed lines of a range of the file, face vertices indices are absolute (0 based) except for the
+//negative ones, relative to the beginning of the range and listed in relative (index*3 + component).
+struct ObjChunk {
+	std::vector<float> vertex, texCoord, normal;
+	std::vector<obj::ObjModel::FaceVertex> index;
+	std::vector<unsigned> face_offsets;
+	std::vector<ObjEvent> events;
+	std::vector<uint32_t> relative;
+};
+
+}
+
+static void parseObjChunk(const char *p, const char *end, ObjChunk &chunk) {
+	while(p < end) {
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if(!eol)
+			eol = end;
+		const char *q = skipSpaces(p, eol);
+		const char *op = q;
+		while(q < eol && *q != ' ' && *q != '\t' && *q != '\r')
+			q++;
+		size_t length = q - op;
+
+		if(length == 1 && op[0] == 'v') {
+			for(int k = 0; k < 3; k++) {
+				chunk.vertex.push_back(0.0f);
+				q = parseFloat(skipSpaces(q, eol), eol, chunk.vertex.back());
+			}
+		} else if(length == 2 && op[0] == 'v' && op[1] == 't') {
+			for(int k = 0; k < 2; k++) {
+				chunk.texCoord.push_back(0.0f);
+				q = parseFloat(skipSpaces(q, eol), eol, chunk.texCoord.back());
+			}
+		} else if(length == 2 && op[0] == 'v' && op[1] == 'n') {
+			for(int k = 0; k < 3; k++) {
+				chunk.normal.push_back(0.0f);
+				q = parseFloat(skipSpaces(q, eol), eol, chunk.normal.back());
+			}
+
+		} else if(length == 1 && op[0] == 'f') {
+			chunk.face_offsets.push_back(chunk.index.size());
+			while(true) {
+				q = skipSpaces(q, eol);
+				int v[3] = { 0, 0, 0 };
+				bool ok;
+				q = parseInt(q, eol, v[0], ok);
+				if(!ok)
+					break;
+				for(int k = 1; k < 3 && q < eol && *q == '/'; k++)
+					q = parseInt(q + 1, eol, v[k], ok);
+				while(q < eol && *q != ' ' && *q != '\t' && *q != '\r')
+					q++;
+
+				size_t counts[3] = { chunk.vertex.size()/3, chunk.texCoord.size()/2, chunk.normal.size()/3 };
+				obj::ObjModel::FaceVertex f;
+				int *target[3] = { &f.v, &f.t, &f.n };
+				for(int k = 0; k < 3; k++) {
+					if(v[k] < 0) {
+						*target[k] = (int)counts[k] + v[k];
+						chunk.relative.push_back(chunk.index.size()*3 + k);
+					} else
+						*target[k] = v[k] - 1;
+				}
+				chunk.index.push_back(f);
+			}
+
+		} else if(length == 1 && op[0] == 'g') {
+			ObjEvent e = { 'g', (uint32_t)chunk.face_offsets.size(), {} };
+			for(std::string word = parseWord(q, eol); word.size(); word = parseWord(q, eol))
+				e.words.push_back(word);
+			chunk.events.push_back(e);
+
+		} else if((length == 6 && !strncmp(op, "usemtl", 6)) || (length == 6 && !strncmp(op, "mtllib", 6))) {
+			ObjEvent e = { op[0], (uint32_t)chunk.face_offsets.size(), {} };
+			std::string word = parseWord(q, eol);
+			if(word.size())
+				e.words.push_back(word);
+			chunk.events.push_back(e);
+		}
+		p = eol + 1;
+	}
+}
+
+//the file is split at line boundaries and each range is parsed on its own thread, then the ranges are
+//merged in order: same results of obj::parseObjModel.
+static bool parseObj(const std::string &filename, int threads, obj::ObjModel &data) {
+	MappedFile file;
+	if(!file.open(filename.c_str()))
+		return false;
+	const char *text = (const char *)file.data();
+	size_t size = file.size();
+
+	size_t nchunks = std::max<size_t>(1, std::min<size_t>(threads, size >> 20));
+	std::vector<size_t> starts(nchunks + 1, size);
+	starts[0] = 0;
+	for(size_t c = 1; c < nchunks; c++) {
+		const char *eol = (const char *)memchr(text + size/nchunks*c, '\n', size - size/nchunks*c);
+		starts[c] = std::max(starts[c - 1], eol? (size_t)(eol + 1 - text) : size);
+	}
+	std::vector<ObjChunk> chunks(nchunks);
+	std::vector<uint32_t> bounds(nchunks + 1);
+	for(size_t c = 0; c <= nchunks; c++)
+		bounds[c] = (uint32_t)c;
+	forRanges(bounds, [&](size_t c) {
+		parseObjChunk(text + starts[c], text + starts[c + 1], chunks[c]);
+	});
+
+	//offsets of each chunk in the merged arrays.
+	std::vector<size_t> vertex(nchunks + 1, 0), texCoord(nchunks + 1, 0), normal(nchunks + 1, 0), index(nchunks + 1, 0), faces(nchunks + 1, 0);
+	for(size_t c = 0; c < nchunks; c++) {
+		vertex[c + 1] = vertex[c] + chunks[c].vertex.size();
+		texCoord[c + 1] = texCoord[c] + chunks[c].texCoord.size();
+		normal[c + 1] = normal[c] + chunks[c].normal.size();
+		index[c + 1] = index[c] + chunks[c].index.size();
+		faces[c + 1] = faces[c] + chunks[c].face_offsets.size();
+	}
+	data.vertex.resize(vertex.back());
+	data.texCoord.resize(texCoord.back());
+	data.normal.resize(normal.back());
+	data.index.resize(index.back());
+	data.face_offsets.resize(faces.back());
+	forRanges(bounds, [&](size_t c) {
+		ObjChunk &chunk = chunks[c];
+		int first[3] = { (int)(vertex[c]/3), (int)(texCoord[c]/2), (int)(normal[c]/3) };
+		for(uint32_t r: chunk.relative) {
+			obj::ObjModel::FaceVertex &f = chunk.index[r/3];
+			int *target[3] = { &f.v, &f.t, &f.n };
+			*target[r%3] += first[r%3];
+		}
+		std::copy(chunk.vertex.begin(), chunk.vertex.end(), data.vertex.begin() + vertex[c]);
+		std::copy(chunk.texCoord.begin(), chunk.texCoord.end(), data.texCoord.begin() + texCoord[c]);
+		std::copy(chunk.normal.begin(), chunk.normal.end(), data.normal.begin() + normal[c]);
+		std::copy(chunk.index.begin(), chunk.index.end(), data.index.begin() + index[c]);
+		for(size_t i = 0; i < chunk.face_offsets.size(); i++)
+			data.face_offsets[faces[c] + i] = chunk.face_offsets[i] + index[c];
+		std::vector<float>().swap(chunk.vertex);
+		std::vector<float>().swap(chunk.texCoord);
+		std::vector<float>().swap(chunk.normal);
+		std::vector<obj::ObjModel::FaceVertex>().swap(chunk.index);
+	});
+
+	//a new block starts at the first face after a g or usemtl line.
+	obj::Block current_block;
+	bool new_block = true;
+	for(size_t c = 0; c < nchunks; c++) {
+		size_t done = faces[c];
+		auto addFaces = [&](size_t face) {
+			if(face > done && new_block) {
+				if(data.blocks.size())
+					data.blocks.back().end = done;
+				current_block.start = done;
+				data.blocks.push_back(current_block);
+				new_block = false;
+			}
+			done = face;
+		};
+		for(ObjEvent &e: chunks[c].events) {
+			addFaces(faces[c] + e.face);
+			if(e.type == 'g') {
+				current_block.groups = std::set<std::string>(e.words.begin(), e.words.end());
+				new_block = true;
+			} else if(e.type == 'u') {
+				if(e.words.size())
+					current_block.material = e.words[0];
+				new_block = true;
+			} else if(e.words.size())
+				data.mtllibs.push_back(e.words[0]);
+		}
+		addFaces(faces[c + 1]);
+	}
+	if(data.blocks.size())
+		data.blocks.back().end = data.face_offsets.size();
+	data.face_offsets.push_back(data.index.size()); //add guard at the end.
+	return true;
+}
+
 bool MeshLoader::loadObj(const std::string &filename, const std::string &groupname) {
 
-	obj::IndexedModel m = obj::loadModelFromFile(filename);
+	obj::IndexedModel m;
+	obj::ObjModel parsed;
+	if(parseObj(filename, threads, parsed)) {
+		obj::tesselateObjModel(parsed);
+		m = obj::convertToModel(parsed);
+	} else
+		m = obj::loadModelFromFile(filename);
 
 	for(auto &mat: m.mtllibs)
 		exif["mtllib"] = mat;
@@ -205,88 +730,148 @@ void MeshLoader::splitWedges() {
 	if(wedge_uvs.size() == 0 && wedge_norms.size() == 0)
 		return;
 
-	std::vector<bool> visited(nvert, false);
 	bool has_wedge_uvs = wedge_uvs.size();
 	bool has_wedge_norms = wedge_norms.size();
+	uint32_t ncorners = index.size();
+	const uint32_t none = 0xffffffff;
+
+	//wedge attributes of corner i, compared as floats.
+	auto same = [&](uint32_t i, uint32_t j) {
+		if(has_wedge_uvs)
+			for(int c = 0; c < 2; c++)
+				if(wedge_uvs[i*2 + c] != wedge_uvs[j*2 + c])
+					return false;
+		if(has_wedge_norms)
+			for(int c = 0; c < 3; c++)
+				if(wedge_norms[i*3 + c] != wedge_norms[j*3 + c])
+					return false;
+		return true;
+	};
+	auto hash = [&](uint32_t i) {
+		uint64_t h = index[i]*0x9e3779b97f4a7c15ull;
+		auto add = [&](float v) {
+			uint32_t bits = 0;
+			if(v != 0.0f) //-0 == 0
+				memcpy(&bits, &v, 4);
+			h = (h ^ bits)*0xff51afd7ed558ccdull;
+		};
+		if(has_wedge_uvs)
+			for(int c = 0; c < 2; c++)
+				add(wedge_uvs[i*2 + c]);
+		if(has_wedge_norms)
+			for(int c = 0; c < 3; c++)
+				add(wedge_norms[i*3 + c]);
+		return h ^ (h >> 32);
+	};
+
+	//the first corner of each vertex gives its attributes.
+	std::vector<std::atomic<uint32_t>> first(nvert);
+	parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+		for(uint32_t k = start; k < end; k++)
+			first[k].store(none, std::memory_order_relaxed);
+	});
+	parallelFor(threads, ncorners, [&](uint32_t start, uint32_t end) {
+		for(uint32_t i = start; i < end; i++) {
+			std::atomic<uint32_t> &f = first[index[i]];
+			uint32_t current = f.load(std::memory_order_relaxed);
+			while(i < current && !f.compare_exchange_weak(current, i, std::memory_order_relaxed));
+		}
+	});
 
 	if(has_wedge_uvs)
-	uvs.resize(nvert*2);
+		uvs.resize(nvert*2);
 	if(has_wedge_norms)
 		norms.resize(nvert*3);
-
-	std::multimap<uint32_t, uint32_t> duplicated;
-	for(uint32_t i = 0; i < index.size(); i++) {
-		uint32_t k = index[i];
-		Point3f p = *(Point3f *)&coords[k*3];
-
-		bool split = false;
-
-		if(has_wedge_uvs) {
-			Point2f wuv = *(Point2f *)&wedge_uvs[i*2]; //wedge uv
-			Point2f &uv = *(Point2f *)&uvs[k*2];
-			if(!visited[k])
-				uv = wuv;
-			else
-				split |= (uv != wuv);
+	parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+		for(uint32_t k = start; k < end; k++) {
+			uint32_t f = first[k].load(std::memory_order_relaxed);
+			if(f == none)
+				continue;
+			if(has_wedge_uvs)
+				for(int c = 0; c < 2; c++)
+					uvs[k*2 + c] = wedge_uvs[f*2 + c];
+			if(has_wedge_norms)
+				for(int c = 0; c < 3; c++)
+					norms[k*3 + c] = wedge_norms[f*3 + c];
 		}
-		if(has_wedge_norms) {
-			Point2f wn = *(Point2f *)&wedge_norms[i*3]; //wedge uv
-			Point2f &n = *(Point2f *)&norms[k*3];
-			if(!visited[k])
-				n = wn;
-			else
-				split |= (n != wn);
+	});
+
+	//corners with attributes different from the first corner of their vertex, in order.
+	std::vector<uint32_t> bounds = splitRanges(ncorners, threads);
+	std::vector<std::vector<uint32_t>> seams(bounds.size() - 1);
+	forRanges(bounds, [&](size_t t) {
+		for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++) {
+			uint32_t k = index[i];
+			bool split = false;
+			if(has_wedge_uvs)
+				for(int c = 0; c < 2; c++)
+					split |= uvs[k*2 + c] != wedge_uvs[i*2 + c];
+			if(has_wedge_norms)
+				for(int c = 0; c < 3; c++)
+					split |= norms[k*3 + c] != wedge_norms[i*3 + c];
+			if(split && first[k].load(std::memory_order_relaxed) != i) //nan never compares equal
+				seams[t].push_back(i);
 		}
-		if(!visited[k]) {
-			visited[k] = true;
-			continue;
-		}
-		if(!split)
-			continue;
-
-		uint32_t found = 0xffffffff;
-		auto d = duplicated.find(k);
-		if(d != duplicated.end()) {
-			auto range = duplicated.equal_range(k);
-			for (auto it = range.first; it != range.second; ++it) {
-				uint32_t j = it->second;
-				if((!has_wedge_uvs || *(Point2f *)&uvs[j*2] == *(Point2f *)&wedge_uvs[i*2]) &&
-				(!has_wedge_norms || *(Point2f *)&norms[j*3] == *(Point2f *)&wedge_norms[i*3]))
-					found = j;
+	});
+
+	//open addressing on (vertex, wedge attributes), new vertices are numbered in order of first corner.
+	size_t nseams = 0;
+	for(auto &s: seams)
+		nseams += s.size();
+	size_t size = 16;
+	while(size < nseams*2)
+		size *= 2;
+	struct Slot { uint32_t k, corner, vertex; };
+	std::vector<Slot> table(size, Slot{ none, none, none });
+	std::vector<std::pair<uint32_t, uint32_t>> added; //first corner and vertex it was split from.
+	for(auto &s: seams) {
+		for(uint32_t i: s) {
+			size_t h = hash(i) & (size - 1);
+			while(table[h].corner != none && !(table[h].k == index[i] && same(table[h].corner, i)))
+				h = (h + 1) & (size - 1);
+			if(table[h].corner == none) {
+				table[h] = Slot{ index[i], i, nvert + (uint32_t)added.size() };
+				added.push_back(std::make_pair(i, index[i]));
 			}
+			index[i] = table[h].vertex;
 		}
-		if(found == 0xffffffff) {
-			found = coords.size()/3;
-			coords.push_back(p[0]);
-			coords.push_back(p[1]);
-			coords.push_back(p[2]);
-			if(norms.size()) {
-				norms.push_back(norms[k*3]);
-				norms.push_back(norms[k*3+1]);
-				norms.push_back(norms[k*3+2]);
-			}
-
-			if(has_wedge_uvs) {
-				uvs.push_back(wedge_uvs[i*2 + 0]);
-				uvs.push_back(wedge_uvs[i*2 + 1]);
-			}
-
-			if(has_wedge_norms) {
-				norms.push_back(wedge_norms[i*3 + 0]);
-				norms.push_back(wedge_norms[i*3 + 1]);
-				norms.push_back(wedge_norms[i*3 + 2]);
-			}
-
-			if(colors.size())
-				for(int j = 0; j < 4; j++)
-					colors.push_back(colors[k*4 + j]);
+	}
 
-			//TODO do the same thing for all other attributes
-			duplicated.insert(std::make_pair(k, found));
+	uint32_t nadded = added.size();
+	coords.resize((size_t)(nvert + nadded)*3);
+	if(norms.size())
+		norms.resize((size_t)(nvert + nadded)*3);
+	if(uvs.size())
+		uvs.resize((size_t)(nvert + nadded)*2);
+	if(colors.size())
+		colors.resize((size_t)(nvert + nadded)*nColorsComponents);
+	if(radiuses.size())
+		radiuses.resize(nvert + nadded);
+	parallelFor(threads, nadded, [&](uint32_t start, uint32_t end) {
+		for(uint32_t a = start; a < end; a++) {
+			uint32_t i = added[a].first;
+			uint32_t k = added[a].second;
+			uint32_t v = nvert + a;
+			for(int c = 0; c < 3; c++)
+				coords[v*3 + c] = coords[k*3 + c];
+			if(has_wedge_norms)
+				for(int c = 0; c < 3; c++)
+					norms[v*3 + c] = wedge_norms[i*3 + c];
+			else if(norms.size())
+				for(int c = 0; c < 3; c++)
+					norms[v*3 + c] = norms[k*3 + c];
+			if(has_wedge_uvs)
+				for(int c = 0; c < 2; c++)
+					uvs[v*2 + c] = wedge_uvs[i*2 + c];
+			else if(uvs.size())
+				for(int c = 0; c < 2; c++)
+					uvs[v*2 + c] = uvs[k*2 + c];
+			for(uint32_t c = 0; c < nColorsComponents && colors.size(); c++)
+				colors[v*nColorsComponents + c] = colors[k*nColorsComponents + c];
+			if(radiuses.size())
+				radiuses[v] = radiuses[k];
 		}
-		assert(found < coords.size()/3);
-		index[i] = found;
-	}
+	});
 	nface = index.size()/3;
 	nvert = coords.size()/3;
 }
@@ -329,28 +914,17 @@ bool MeshLoader::savePly(const string &filename, std::vector<std::string> &comme
 }
 
 void MeshLoader::addNormals() {
-
-	norms.resize(nvert*3, 0);
-
-	uint32_t *end = index.data() + index.size();
-	Point3f *coord = (Point3f *)coords.data();
+	norms.resize(nvert*3);
 	Point3f *norm = (Point3f *)norms.data();
-	for(uint32_t *f = index.data(); f < end; f += 3) {
-		assert(f[0]*3 < coords.size());
-		Point3f &p0 = coord[f[0]];
-		Point3f &p1 = coord[f[1]];
-		Point3f &p2 = coord[f[2]];
-		Point3f n = (( p1 - p0) ^ (p2 - p0));
-		norm[f[0]] += n+Point3f(10, 10, 10);
-		norm[f[1]] += n+Point3f(10, 10, 10);
-		norm[f[2]] += n+Point3f(10, 10, 10);
-	}
-	for(uint32_t i = 0; i < nvert; i++) {
-		Point3f &n = norm[i];
-		float len = n.norm();
-		if(len == 0)
-			n = Point3f(0, 0, 1);
-		else
-			n /= len;
-	}
+	NormalAttr::estimateNormals(nvert, (const Point3f *)coords.data(), nface, index.data(), norm, threads);
+	parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+		for(uint32_t i = start; i < end; i++) {
+			Point3f &n = norm[i];
+			float len = n.norm();
+			if(len == 0)
+				n = Point3f(0, 0, 1);
+			else
+				n /= len;
+		}
+	});
 }
@@ -35,7 +35,7 @@ public:
 		Group(uint32_t e = 0): end(e) {}
 	};
 
-	MeshLoader(): add_normals(false) {}
+	MeshLoader(): add_normals(false), threads(1) {}
 	bool load(const std::string &filename, const std::string &group = "");
 	bool loadPly(const std::string &filename);
 	bool loadObj(const std::string &filename, const std::string &group);
@@ -43,6 +43,7 @@ public:
 	bool savePly(const std::string &filename, std::vector<std::string> &comments);
 
 	bool add_normals;    //add normals (if not present) before splitting groups.
+	int threads;         //used to convert binary ply records and add normals (1 is serial).
 	uint32_t nface;
 	uint32_t nvert;
 	std::vector<float> coords;
@@ -63,6 +64,8 @@ public:
 
 protected:
 	void addNormals();
+	//binary little endian ply with fixed size records read from a memory map, false for anything else.
+	bool loadPlyMapped(const std::string &filename, std::vector<std::string> &comments);
 };
 
 } //namespace
@@ -21,41 +21,229 @@ If not, see <http://www.gnu.org/licenses/>.
 
 using namespace crt;
 
-template <class T> void markBoundary(uint32_t nvert, uint32_t nface, T *index, std::vector<int32_t> &boundary) {
-	boundary.clear();
-	boundary.resize(nvert, 0);
-
-	T *end = index + nface*3;
-	for(T *f = index; f < end; f += 3) {
-		boundary[f[0]] ^= (int)f[1];
-		boundary[f[0]] ^= (int)f[2];
-		boundary[f[1]] ^= (int)f[2];
-		boundary[f[1]] ^= (int)f[0];
-		boundary[f[2]] ^= (int)f[0];
-		boundary[f[2]] ^= (int)f[1];
+//faces are passed group by group (see IndexAttribute::visitGroups), indices are relative to base.
+//only vertices in [first, last) are written, so that disjoint ranges can be marked concurrently.
+class BoundaryMarker {
+public:
+	std::vector<int32_t> &boundary;
+	uint32_t first, last;
+	BoundaryMarker(std::vector<int32_t> &b, uint32_t f, uint32_t l): boundary(b), first(f), last(l) {}
+
+	bool owns(uint32_t v) { return v >= first && v < last; }
+
+	template <class T> void operator()(T *index, uint32_t nface, uint32_t base) {
+		T *end = index + nface*3;
+		for(T *f = index; f < end; f += 3) {
+			uint32_t v0 = f[0] + base;
+			uint32_t v1 = f[1] + base;
+			uint32_t v2 = f[2] + base;
+			if(owns(v0)) {
+				boundary[v0] ^= (int)v1;
+				boundary[v0] ^= (int)v2;
+			}
+			if(owns(v1)) {
+				boundary[v1] ^= (int)v2;
+				boundary[v1] ^= (int)v0;
+			}
+			if(owns(v2)) {
+				boundary[v2] ^= (int)v0;
+				boundary[v2] ^= (int)v1;
+			}
+		}
+	}
+};
+
+//same as BoundaryMarker: a vertex sums its face normals in face order whatever the range,
+//the result does not depend on the number of threads. P is Point3i (quantized) or Point3f.
+template <class P> class NormalEstimator {
+public:
+	const P *coords;
+	Point3f *estimated;
+	uint32_t first, last;
+	NormalEstimator(const P *c, Point3f *e, uint32_t f, uint32_t l): coords(c), estimated(e), first(f), last(l) {}
+
+	bool owns(uint32_t v) { return v - first < last - first; }
+
+	static Point3f toFloat(const Point3i &p) { return Point3f(p[0], p[1], p[2]); }
+	static const Point3f &toFloat(const Point3f &p) { return p; }
+
+	template <class T> void operator()(T *index, uint32_t nface, uint32_t base) {
+		T *end = index + nface*3;
+		for(T *f = index; f < end; f += 3) {
+			uint32_t i0 = f[0] + base;
+			uint32_t i1 = f[1] + base;
+			uint32_t i2 = f[2] + base;
+			bool o0 = owns(i0), o1 = owns(i1), o2 = owns(i2);
+			if(!o0 && !o1 && !o2)
+				continue;
+			Point3f v0 = toFloat(coords[i0]); //overflow!
+			Point3f v1 = toFloat(coords[i1]);
+			Point3f v2 = toFloat(coords[i2]);
+			Point3f n = (( v1 - v0) ^ (v2 - v0));
+			if(o0) estimated[i0] += n;
+			if(o1) estimated[i1] += n;
+			if(o2) estimated[i2] += n;
+		}
+	//since using toOcta this is not needed.
+	//	for(Point3f &n: estimated)
+	//		n /= n.norm();
+	}
+};
+
+//faces for preDelta, where the index is not split in groups yet.
+class FaceList {
+public:
+	const uint32_t *faces;
+	uint32_t nface;
+	FaceList(const uint32_t *f, uint32_t n): faces(f), nface(n) {}
+	template <class F> void visitGroups(F &f) { f(faces, nface, 0); }
+};
+
+//faces in blocks with the range of their vertices, so that a thread skips the blocks without vertices it owns.
+//Blocks are visited in index order. A single range visits all the faces.
+class FaceBlocks {
+public:
+	template <class I> FaceBlocks(I &index, const std::vector<uint32_t> &bounds): nface(0) {
+		index.visitGroups(*this);
+		if(bounds.size() == 2)
+			return;
+
+		uint32_t nblocks = (nface + block - 1)/block;
+		blocks.resize(nblocks);
+		std::vector<uint32_t> chunks = splitRanges(nblocks, (int)bounds.size() - 1, 16);
+		forRanges(chunks, [&](size_t c) {
+			size_t segment = 0;
+			for(uint32_t b = chunks[c]; b < chunks[c + 1]; b++) {
+				Block range;
+				spans(segment, b*block, std::min(nface, (b + 1)*block), range);
+				blocks[b] = range;
+			}
+		});
+	}
+
+	//f(faces, nface, base) in index order for the blocks with vertices in [first, last), as visitGroups.
+	template <class F> void visit(uint32_t first, uint32_t last, F &f) {
+		size_t segment = 0;
+		if(blocks.empty()) {
+			spans(segment, 0, nface, f);
+			return;
+		}
+		uint32_t nblocks = blocks.size();
+		for(uint32_t b = 0; b < nblocks; b++) {
+			uint32_t end = b;
+			while(end < nblocks && blocks[end].min < last && blocks[end].max >= first)
+				end++;
+			if(end > b)
+				spans(segment, b*block, std::min(nface, end*block), f);
+			b = end;
+		}
 	}
+
+	//called by visitGroups: faces are numbered across the groups.
+	template <class T> void operator()(T *index, uint32_t n, uint32_t base) {
+		segments.push_back(Segment(index, nface, n, base));
+		nface += n;
+	}
+
+private:
+	static const uint32_t block = 256;
+	struct Segment {
+		const uint16_t *faces16;
+		const uint32_t *faces32;
+		uint32_t start, nface, base;
+		Segment(const uint16_t *f, uint32_t s, uint32_t n, uint32_t b): faces16(f), faces32(nullptr), start(s), nface(n), base(b) {}
+		Segment(const uint32_t *f, uint32_t s, uint32_t n, uint32_t b): faces16(nullptr), faces32(f), start(s), nface(n), base(b) {}
+	};
+	//vertices of the faces of a block, computed by visiting them.
+	struct Block {
+		uint32_t min, max;
+		Block(): min(0xffffffff), max(0) {}
+		template <class T> void operator()(const T *index, uint32_t nface, uint32_t base) {
+			T lo = index[0], hi = index[0]; //plain reductions, vectorized.
+			for(uint32_t i = 1; i < nface*3; i++) {
+				lo = std::min(lo, index[i]);
+				hi = std::max(hi, index[i]);
+			}
+			min = std::min(min, lo + base);
+			max = std::max(max, hi + base);
+		}
+	};
+	uint32_t nface;
+	std::vector<Segment> segments;
+	std::vector<Block> blocks; //empty for a single range.
+
+	//f(faces, nface, base) for the faces in [first, last), segment is the first one to check (faces are visited in order).
+	template <class F> void spans(size_t &segment, uint32_t first, uint32_t last, F &f) {
+		for(; segment < segments.size(); segment++) {
+			Segment &s = segments[segment];
+			uint32_t a = std::max(first, s.start);
+			uint32_t b = std::min(last, s.start + s.nface);
+			if(a < b) {
+				if(s.faces16)
+					f(s.faces16 + (a - s.start)*3, b - a, s.base);
+				else
+					f(s.faces32 + (a - s.start)*3, b - a, s.base);
+			}
+			if(last <= s.start + s.nface)
+				break;
+		}
+	}
+};
+
+//estimated normals and boundary marks, each thread owns a range of vertices.
+template <class I> static void estimate(NormalAttr &attr, const std::vector<uint32_t> &bounds, Point3i *coords, std::vector<Point3f> &estimated, I &index) {
+	uint32_t nvert = bounds.back();
+	estimated.assign(nvert, Point3f(0, 0, 0));
+	if(attr.prediction == NormalAttr::BORDER)
+		attr.boundary.assign(nvert, 0);
+
+	FaceBlocks faces(index, bounds);
+	forRanges(bounds, [&](size_t t) {
+		NormalEstimator<Point3i> estimator(coords, estimated.data(), bounds[t], bounds[t + 1]);
+		faces.visit(bounds[t], bounds[t + 1], estimator);
+		if(attr.prediction == NormalAttr::BORDER) {
+			BoundaryMarker marker(attr.boundary, bounds[t], bounds[t + 1]);
+			faces.visit(bounds[t], bounds[t + 1], marker);
+		}
+	});
 }
 
+void NormalAttr::estimateNormals(uint32_t nvert, const Point3f *coords, uint32_t nface, const uint32_t *index, Point3f *normals, int threads) {
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
+	FaceList list(index, nface);
+	FaceBlocks faces(list, bounds);
+	forRanges(bounds, [&](size_t t) {
+		std::fill(normals + bounds[t], normals + bounds[t + 1], Point3f(0, 0, 0));
+		NormalEstimator<Point3f> estimator(coords, normals, bounds[t], bounds[t + 1]);
+		faces.visit(bounds[t], bounds[t + 1], estimator);
+	});
+}
 
-template <class T> void estimateNormals(uint32_t nvert, Point3i *coords, uint32_t nface, T *index, std::vector<Point3f> &estimated) {
-	estimated.clear();
-	estimated.resize(nvert, Point3f(0, 0, 0));
-	T *end = index + nface*3;
-	for(T *f = index; f < end; f += 3) {
-		Point3i &p0 = coords[f[0]]; //overflow!
-		Point3i &p1 = coords[f[1]];
-		Point3i &p2 = coords[f[2]];
-		Point3f v0(p0[0], p0[1], p0[2]);
-		Point3f v1(p1[0], p1[1], p1[2]);
-		Point3f v2(p2[0], p2[1], p2[2]);
-		Point3f n = (( v1 - v0) ^ (v2 - v0));
-		estimated[f[0]] += n;
-		estimated[f[1]] += n;
-		estimated[f[2]] += n;
+//produce(start, end, out) writes packed normals for vertices in [first, last), interleaved output goes through a small block.
+template <class F> static void writeRows(NormalAttr &attr, uint32_t first, uint32_t last, F produce) {
+	uint32_t bytes = attr.outComponents()*VertexAttribute::formatBytes(attr.format);
+	if(!attr.stride || attr.stride == bytes) {
+		produce(first, last, attr.buffer + first*bytes);
+		return;
+	}
+	const uint32_t block = 256;
+	std::vector<char> packed(block*bytes);
+	for(uint32_t start = first; start < last; start += block) {
+		uint32_t end = std::min(last, start + block);
+		produce(start, end, packed.data());
+		for(uint32_t i = start; i < end; i++)
+			memcpy(attr.buffer + i*attr.stride, packed.data() + (i - start)*bytes, bytes);
 	}
-//since using toOcta this is not needed.
-//	for(Point3f &n: estimated)
-//		n /= n.norm();
+}
+
+//writeRows on each range in parallel, count starts at the number of diffs used before the range.
+template <class F> static void writeRanges(NormalAttr &attr, const std::vector<uint32_t> &bounds, const std::vector<uint32_t> &counts, F produce) {
+	forRanges(bounds, [&](size_t t) {
+		uint32_t count = counts[t];
+		writeRows(attr, bounds[t], bounds[t + 1], [&](uint32_t start, uint32_t end, char *out) {
+			produce(start, end, out, count);
+		});
+	});
 }
 
 void NormalAttr::quantize(uint32_t nvert, const char *buffer) {
@@ -64,42 +252,59 @@ void NormalAttr::quantize(uint32_t nvert, const char *buffer) {
 	values.resize(n);
 	diffs.resize(n);
 
-	Point2i *normals = (Point2i *)values.data();
-	switch(format) {
-	case FLOAT:
-		for(uint32_t i = 0; i < nvert; i++) 
-			normals[i] = toOcta(((const Point3f *)buffer)[i], (int)q);
-		break;
-	case INT32:
-		for(uint32_t i = 0; i < nvert; i++)
-			normals[i] =  toOcta(((const Point3i *)buffer)[i], (int)q);
-		break;
-	case INT16:
-	{
-		Point3<int16_t> *s = (Point3<int16_t> *)buffer;
-		for(uint32_t i = 0; i < nvert; i++)
-			normals[i] = toOcta(Point3i(s[i][0], s[i][1], s[i][2]), (int)q);
-		break;
-	}
-	case INT8:
-	{
-		Point3<int8_t> *s = (Point3<int8_t> *)buffer;
-		for(uint32_t i = 0; i < nvert; i++)
-			normals[i] = toOcta(Point3i(s[i][0], s[i][1], s[i][2]), (int)q);
-		break;
-	}
-	default:
-#ifndef NO_EXCEPTIONS 
+#ifndef NO_EXCEPTIONS
+	if(format != FLOAT && format != INT32 && format != INT16 && format != INT8)
 		throw "Unsigned types not supported for normals";
-#else
-		break;
 #endif
-	}
-	Point2i min(values[0], values[1]);
-	Point2i max(min);
-	for(uint32_t i = 1; i < nvert; i++) {
-		min.setMin(normals[i]);
-		max.setMax(normals[i]);
+	//each range of vertices is converted and reports its min and max.
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
+	std::vector<Point2i> ranges((bounds.size() - 1)*2);
+	Point2i *normals = (Point2i *)values.data();
+	forRanges(bounds, [&](size_t t) {
+		uint32_t start = bounds[t];
+		uint32_t end = bounds[t + 1];
+		switch(format) {
+		case FLOAT:
+			Simd::toOcta((const Point3f *)buffer + start, (int32_t *)(normals + start), end - start, (int)q);
+			break;
+		case INT32:
+			for(uint32_t i = start; i < end; i++)
+				normals[i] =  toOcta(((const Point3i *)buffer)[i], (int)q);
+			break;
+		case INT16:
+		{
+			Point3<int16_t> *s = (Point3<int16_t> *)buffer;
+			for(uint32_t i = start; i < end; i++)
+				normals[i] = toOcta(Point3i(s[i][0], s[i][1], s[i][2]), (int)q);
+			break;
+		}
+		case INT8:
+		{
+			Point3<int8_t> *s = (Point3<int8_t> *)buffer;
+			for(uint32_t i = start; i < end; i++)
+				normals[i] = toOcta(Point3i(s[i][0], s[i][1], s[i][2]), (int)q);
+			break;
+		}
+		default:
+			break;
+		}
+		if(start == end)
+			return;
+		Point2i &min = ranges[t*2];
+		Point2i &max = ranges[t*2 + 1];
+		min = max = normals[start];
+		for(uint32_t i = start + 1; i < end; i++) {
+			min.setMin(normals[i]);
+			max.setMax(normals[i]);
+		}
+	});
+	if(!nvert)
+		return;
+	Point2i min = ranges[0];
+	Point2i max = ranges[1];
+	for(size_t t = 1; t + 1 < bounds.size(); t++) {
+		min.setMin(ranges[t*2]);
+		max.setMax(ranges[t*2 + 1]);
 	}
 	max -= min;
 	bits = std::max(ilog2(max[0]-1), ilog2(max[1]-1)) + 1;
@@ -122,52 +327,82 @@ void NormalAttr::preDelta(uint32_t nvert,  uint32_t nface, std::map<std::string,
 		throw "Position attr has been overloaded, Use DIFF normal strategy instead.";
 #endif
 
-	uint32_t *start = index.faces.data();
-	//estimate normals using vertices and faces existing.
+	//estimate normals using vertices and faces existing, boundary points are marked on original vertices.
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
 	std::vector<Point3f> estimated;
-	estimateNormals<uint32_t>(nvert, (Point3i *)coord->values.data(), nface, start, estimated);
-
-	if(prediction == BORDER)
-		markBoundary<uint32_t>(nvert, nface, start, boundary); //mark boundary points on original vertices.
-
-	Point2i *v= (Point2i *)values.data();
-	for(uint32_t i = 0; i < nvert; i++) {
-		Point2i n = toOcta(estimated[i], (int)q);
-		v[i] -= n;
-	}
+	FaceList faces(index.faces.data(), nface);
+	estimate(*this, bounds, (Point3i *)coord->values.data(), estimated, faces);
+
+	Point2i *v = (Point2i *)values.data();
+	forRanges(bounds, [&](size_t t) {
+		const uint32_t block = 256;
+		Point2i octa[block];
+		for(uint32_t start = bounds[t]; start < bounds[t + 1]; start += block) {
+			uint32_t n = std::min(bounds[t + 1] - start, block);
+			Simd::toOcta(&estimated[start], (int32_t *)octa, n, (int)q);
+			for(uint32_t i = 0; i < n; i++)
+				v[start + i] -= octa[i];
+		}
+	});
 }
 
 void NormalAttr::deltaEncode(std::vector<Quad> &context) {
+	uint32_t nvert = context.size();
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
 
 	if(prediction == DIFF) {
 		diffs[0] = values[context[0].t*2];
 		diffs[1] = values[context[0].t*2+1];
 
-		for(uint32_t i = 1; i < context.size(); i++) {
-			Quad &quad = context[i];
-			diffs[i*2 + 0] = values[quad.t*2 + 0] - values[quad.a*2 + 0];
-			diffs[i*2 + 1] = values[quad.t*2 + 1] - values[quad.a*2 + 1];
-			//seems to make a small difference
-//			diffs[i*2 + 0] = values[quad.t*2 + 0] - (values[quad.a*2 + 0] + values[quad.b*2 + 0] - values[quad.c*2 + 0]);
-//			diffs[i*2 + 1] = values[quad.t*2 + 1] - (values[quad.a*2 + 1] + values[quad.b*2 + 1] - values[quad.c*2 + 1]);
-		}
+		forRanges(bounds, [&](size_t t) {
+			for(uint32_t i = std::max(bounds[t], 1u); i < bounds[t + 1]; i++) {
+				Quad &quad = context[i];
+				diffs[i*2 + 0] = values[quad.t*2 + 0] - values[quad.a*2 + 0];
+				diffs[i*2 + 1] = values[quad.t*2 + 1] - values[quad.a*2 + 1];
+				//seems to make a small difference
+//				diffs[i*2 + 0] = values[quad.t*2 + 0] - (values[quad.a*2 + 0] + values[quad.b*2 + 0] - values[quad.c*2 + 0]);
+//				diffs[i*2 + 1] = values[quad.t*2 + 1] - (values[quad.a*2 + 1] + values[quad.b*2 + 1] - values[quad.c*2 + 1]);
+			}
+		});
 		diffs.resize(context.size()*2); //unreferenced vertices
 
 	} else  {//just reorder diffs, for border story only boundary diffs
-		uint32_t count = 0;
-
-		for(uint32_t i = 0; i < context.size(); i++) {
-			Quad &quad = context[i];
-			if(prediction != BORDER || boundary[quad.t] != 0) { //boundary mark is in old index.
-				diffs[count*2 + 0] = values[quad.t*2 + 0];
-				diffs[count*2 + 1] = values[quad.t*2 + 1];
-				count++;
+		//count the diffs of each range first, so that ranges can be copied independently.
+		std::vector<uint32_t> counts(bounds.size(), 0);
+		forRanges(bounds, [&](size_t t) {
+			for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++)
+				if(prediction != BORDER || boundary[context[i].t] != 0) //boundary mark is in old index.
+					counts[t + 1]++;
+		});
+		for(size_t t = 1; t < counts.size(); t++)
+			counts[t] += counts[t - 1];
+
+		forRanges(bounds, [&](size_t t) {
+			uint32_t count = counts[t];
+			for(uint32_t i = bounds[t]; i < bounds[t + 1]; i++) {
+				Quad &quad = context[i];
+				if(prediction != BORDER || boundary[quad.t] != 0) {
+					diffs[count*2 + 0] = values[quad.t*2 + 0];
+					diffs[count*2 + 1] = values[quad.t*2 + 1];
+					count++;
+				}
 			}
-		}
-		diffs.resize(count*2); //unreferenced vertices and borders
+		});
+		diffs.resize(counts.back()*2); //unreferenced vertices and borders
 	}
 }
 
+void NormalAttr::merge(const uint32_t *vertices, uint32_t n) {
+	Point3f sum(0.0f);
+	for(uint32_t i = 0; i < n; i++)
+		sum += toSphere(Point2i(values[vertices[i]*2], values[vertices[i]*2 + 1]), (int)q);
+	if(sum.norm() == 0.0f) //opposite normals, keep the first.
+		return;
+	Point2i octa = toOcta(sum, (int)q);
+	values[vertices[0]*2 + 0] = octa[0];
+	values[vertices[0]*2 + 1] = octa[1];
+}
+
 void NormalAttr::encode(uint32_t /*nvert*/, OutStream &stream) {
 	stream.write<uchar>(prediction);
 	stream.restart();
@@ -178,12 +413,18 @@ void NormalAttr::encode(uint32_t /*nvert*/, OutStream &stream) {
 void NormalAttr::decode(uint32_t nvert, InStream &stream) {
 	prediction = stream.readUint8();
 	diffs.resize(nvert*2);
-	uint32_t readed = stream.decodeArray<int32_t>(diffs.data(), 2);
+	uint32_t readed = stream.decodeArray<int32_t>(diffs.data(), 2, nvert);
 
 	if(prediction == BORDER)
 		diffs.resize(readed*2);
 }
 
+bool NormalAttr::skip(InStream &stream) {
+	stream.readUint8(); //prediction
+	stream.skipArray();
+	return true;
+}
+
 void NormalAttr::deltaDecode(uint32_t nvert, std::vector<Face> &context) {
 	if(!buffer) return;
 
@@ -200,14 +441,11 @@ void NormalAttr::deltaDecode(uint32_t nvert, std::vector<Face> &context) {
 
 		}
 	} else { //point clouds assuming values are already sorted by proximity.
-		for(uint32_t i = 2; i < nvert*2; i++) {
-			int &d = diffs[i];
-			d += diffs[i-2];
-		}
+		prefixSum(diffs.data(), nvert, 2, threads);
 	}
 }
 
-void NormalAttr::postDelta(uint32_t nvert, uint32_t nface,
+void NormalAttr::postDelta(uint32_t nvert, uint32_t /*nface*/,
 						   std::map<std::string, VertexAttribute *> &attrs,
 						   IndexAttribute &index) {
 	if(!buffer) return;
@@ -225,29 +463,55 @@ void NormalAttr::postDelta(uint32_t nvert, uint32_t nface,
 	if(!coord)
 		throw "Position attr has been overloaded, Use DIFF normal strategy instead.";
 #endif
-	std::vector<Point3f> estimated(nvert, Point3f(0, 0, 0));
-	if(index.faces32)
-		estimateNormals<uint32_t>(nvert, (Point3i *)coord->buffer, nface, index.faces32, estimated);
-	else
-		estimateNormals<uint16_t>(nvert, (Point3i *)coord->buffer, nface, index.faces16, estimated);
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
+	std::vector<Point3f> estimated;
+	estimate(*this, bounds, (Point3i *)coord->quantized(), estimated, index);
 
+	//diffs used before each range.
+	std::vector<uint32_t> counts(bounds);
 	if(prediction == BORDER) {
-		if(index.faces32)
-			markBoundary<uint32_t>(nvert, nface, index.faces32, boundary);
-		else
-			markBoundary<uint16_t>(nvert, nface, index.faces16, boundary);
+		counts[0] = 0;
+		for(size_t t = 1; t < bounds.size(); t++) {
+			counts[t] = counts[t - 1];
+			for(uint32_t i = bounds[t - 1]; i < bounds[t]; i++)
+				if(boundary[i]) counts[t]++;
+		}
 	}
 
+	octaRange();
 	switch(format) {
 	case FLOAT:
-		computeNormals((Point3f *)buffer, estimated);
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &count) {
+			computeNormals((Point3f *)out, estimated, start, end, count);
+		});
 		break;
 	case INT16:
-		computeNormals((Point3s *)buffer, estimated);
+	case SNORM16:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &count) {
+			computeNormals((Point3s *)out, estimated, start, end, count);
+		});
+		break;
+	case SNORM8:
+	case HALF:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &count) {
+			std::vector<Point3f> normals(end - start);
+			computeNormals(normals.data(), estimated, start, end, count);
+			store(normals.data(), end - start, out);
+		});
+		break;
+	case OCTA32:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &count) {
+			computeNormals((Point2i *)out, estimated, start, end, count);
+		});
+		break;
+	case OCTA16:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &count) {
+			computeNormals((Point2s *)out, estimated, start, end, count);
+		});
 		break;
 	default: 
 #ifndef NO_EXCEPTIONS
-		throw "Format not supported for normal attribute (float, int16 only)";
+		throw "Format not supported for normal attribute (float, int16, snorm16, snorm8, half, octa16 or octa32 only)";
 #else
 		break;
 #endif
@@ -260,32 +524,125 @@ void NormalAttr::dequantize(uint32_t nvert) {
 	if(prediction != DIFF)
 		return;
 
+	std::vector<uint32_t> bounds = splitRanges(nvert, threads);
+	std::vector<uint32_t> counts(bounds.size(), 0); //not used
+	octaRange();
 	switch(format) {
 	case FLOAT:
-		for(uint32_t i = 0; i < nvert; i++)
-			((Point3f *)buffer)[i] = toSphere(Point2i(diffs[i*2], diffs[i*2 + 1]), (int)q);
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &) {
+			Simd::toSphere(diffs.data() + start*2, (Point3f *)out, end - start, (int)q);
+		});
 		break;
 	case INT16:
-		for(uint32_t i = 0; i < nvert; i++)
-			((Point3s *)buffer)[i] = toSphere(Point2s(diffs[i*2], diffs[i*2 + 1]), (int)q);
+	case SNORM16:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &) {
+			Simd::toSphere(diffs.data() + start*2, (Point3s *)out, end - start, (int)q);
+		});
+		break;
+	case SNORM8:
+	case HALF:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &) {
+			std::vector<Point3f> normals(end - start);
+			Simd::toSphere(diffs.data() + start*2, normals.data(), end - start, (int)q);
+			store(normals.data(), end - start, out);
+		});
+		break;
+	case OCTA32:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &) {
+			memcpy(out, diffs.data() + start*2, (end - start)*sizeof(Point2i));
+		});
+		break;
+	case OCTA16:
+		writeRanges(*this, bounds, counts, [&](uint32_t start, uint32_t end, char *out, uint32_t &) {
+			for(uint32_t i = start*2; i < end*2; i++)
+				((int16_t *)out)[i - start*2] = (int16_t)diffs[i];
+		});
 		break;
 	default:
 #ifndef NO_EXCEPTIONS
-		throw "Format not supported for normal attribute (float, int32 or int16 only)";
+		throw "Format not supported for normal attribute (float, int16, snorm16, snorm8, half, octa16 or octa32 only)";
 #else
 		break;
 #endif
 	}
 }
 
-void NormalAttr::computeNormals(Point3s *normals, std::vector<Point3f> &estimated) {
-	uint32_t nvert = estimated.size();
+//SNORM8 truncates as INT16 does.
+void NormalAttr::store(const Point3f *normals, uint32_t nvert, char *out) {
+	uint32_t n = nvert*3;
+	const float *v = (const float *)normals;
+	if(format == SNORM8) {
+		for(uint32_t i = 0; i < n; i++)
+			((int8_t *)out)[i] = (int8_t)(v[i]*127.0f);
+	} else {
+		for(uint32_t i = 0; i < n; i++)
+			((uint16_t *)out)[i] = toHalf(v[i]);
+	}
+}
 
+int NormalAttr::outComponents() {
+	return (format == OCTA16 || format == OCTA32)? 2 : 3;
+}
+
+void NormalAttr::octaRange() {
+	if(outComponents() != 2)
+		return;
+#ifndef NO_EXCEPTIONS
+	if(format == OCTA16 && q > 32767)
+		throw "OCTA16 output requires normals quantized with at most 15 bits.";
+#endif
+	offset.assign(2, 0.0f);
+	scale.assign(2, 1.0f/q);
+}
+
+//the estimate goes through Simd::toOcta as in preDelta: the diff of a zero estimate only restores the encoded value this way.
+template <class S> static void computeOcta(NormalAttr &attr, Point2<S> *octa, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	const uint32_t block = 256;
+	Point2i qn[block];
+	Point2i *diffp = (Point2i *)attr.diffs.data();
+	for(uint32_t s = start; s < end; s += block) {
+		uint32_t n = std::min(end - s, block);
+		Simd::toOcta(&estimated[s], (int32_t *)qn, n, (int)attr.q);
+		for(uint32_t i = 0; i < n; i++) {
+			if(attr.prediction == NormalAttr::ESTIMATED || attr.boundary[s + i])
+				qn[i] += diffp[count++];
+			octa[s - start + i] = Point2<S>(qn[i][0], qn[i][1]);
+		}
+	}
+}
+
+//with ESTIMATED every vertex is corrected: to octahedral and back a block at a time.
+template <class P> static void correctAll(NormalAttr &attr, P *normals, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	const uint32_t block = 256;
+	int32_t octa[block*2];
+	for(uint32_t s = start; s < end; s += block) {
+		uint32_t n = std::min(end - s, block);
+		Simd::toOcta(&estimated[s], octa, n, (int)attr.q);
+		const int32_t *d = attr.diffs.data() + count*2;
+		for(uint32_t i = 0; i < n*2; i++)
+			octa[i] += d[i];
+		Simd::toSphere(octa, normals + (s - start), n, (int)attr.q);
+		count += n;
+	}
+}
+
+void NormalAttr::computeNormals(Point2i *octa, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	computeOcta(*this, octa, estimated, start, end, count);
+}
+
+void NormalAttr::computeNormals(Point2s *octa, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	computeOcta(*this, octa, estimated, start, end, count);
+}
+
+void NormalAttr::computeNormals(Point3s *normals, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	if(prediction == ESTIMATED) {
+		correctAll(*this, normals, estimated, start, end, count);
+		return;
+	}
 	Point2i *diffp = (Point2i *)diffs.data();
-	int count = 0; //here for the border.
-	for(unsigned int i = 0; i < nvert; i++) {
+	for(uint32_t i = start; i < end; i++) {
 		Point3f &e = estimated[i];
-		Point3s &n = normals[i];
+		Point3s &n = normals[i - start];
 
 		if(prediction == ESTIMATED || boundary[i]) {
 			Point2i &d = diffp[count++];
@@ -294,7 +651,7 @@ void NormalAttr::computeNormals(Point3s *normals, std::vector<Point3f> &estimate
 		} else {//no correction
 			float len = e.norm();
 			if(len < 0.00001f)
-				e = Point3f(0, 0, 1);
+				n = Point3s(0, 0, 32767);
 			else {
 				len = 32767.0f/len;
 				for(int k = 0; k < 3; k++)
@@ -304,14 +661,15 @@ void NormalAttr::computeNormals(Point3s *normals, std::vector<Point3f> &estimate
 	}
 }
 
-void NormalAttr::computeNormals(Point3f *normals, std::vector<Point3f> &estimated) {
-	uint32_t nvert = estimated.size();
-
+void NormalAttr::computeNormals(Point3f *normals, std::vector<Point3f> &estimated, uint32_t start, uint32_t end, uint32_t &count) {
+	if(prediction == ESTIMATED) {
+		correctAll(*this, normals, estimated, start, end, count);
+		return;
+	}
 	Point2i *diffp = (Point2i *)diffs.data();
-	int count = 0; //here for the border.
-	for(unsigned int i = 0; i < nvert; i++) {
+	for(uint32_t i = start; i < end; i++) {
 		Point3f &e = estimated[i];
-		Point3f &n = normals[i];
+		Point3f &n = normals[i - start];
 
 		if(prediction == ESTIMATED || boundary[i]) {
 			Point2i qn = toOcta(e, (int)q);
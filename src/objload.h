@@ -266,13 +266,30 @@ IndexedModel convertToModel(const ObjModel & obj ) {
 	IndexedModel model;
 	model.mtllibs = obj.mtllibs;
 
-	//sort facevertices according to coord index, then texture then normal index.
-	std::vector<std::pair<ObjModel::FaceVertex, uint32_t>> vertices;
-	vertices.reserve(obj.index.size());
-	for(uint32_t i = 0; i < obj.index.size(); i++)
-		vertices.emplace_back(std::make_pair(obj.index[i], i));
+	//sort facevertices according to coord index, then texture then normal index:
+	//counting sort on the coord index, then each bucket (a few corners) is sorted.
+	int minv = 0, maxv = -1;
+	if(obj.index.size())
+		minv = maxv = obj.index[0].v;
+	for(const ObjModel::FaceVertex &f: obj.index) {
+		minv = std::min(minv, f.v);
+		maxv = std::max(maxv, f.v);
+	}
+	std::vector<uint32_t> buckets((size_t)(maxv - minv) + 2, 0);
+	for(const ObjModel::FaceVertex &f: obj.index)
+		buckets[f.v - minv + 1]++;
+	for(size_t b = 1; b < buckets.size(); b++)
+		buckets[b] += buckets[b-1];
 
-	std::sort(vertices.begin(), vertices.end());
+	std::vector<std::pair<ObjModel::FaceVertex, uint32_t>> vertices(obj.index.size());
+	for(uint32_t i = 0; i < obj.index.size(); i++)
+		vertices[buckets[obj.index[i].v - minv]++] = std::make_pair(obj.index[i], i);
+	uint32_t start = 0;
+	for(size_t b = 0; b + 1 < buckets.size(); b++) {
+		if(buckets[b] - start > 1)
+			std::sort(vertices.begin() + start, vertices.begin() + buckets[b]);
+		start = buckets[b];
+	}
 
 	//collapse facevertices with same v, t, e n indices
 	//build vertex remap for faces
@@ -0,0 +1,821 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received 
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "simd.h"
+#include "normal_attribute.h"
+
+#ifndef NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CRT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRT_AVX2
+#else
+#define CRT_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CRT_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+using namespace crt;
+
+Simd::Level Simd::level = Simd::detect();
+
+Simd::Level Simd::detect() {
+#if defined(CRT_X86)
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7)
+		return SSE2;
+	__cpuid(info, 1);
+	bool avx = (info[2] & (1<<27)) && (info[2] & (1<<28)); //osxsave and avx
+	__cpuidex(info, 7, 0);
+	bool avx2 = info[1] & (1<<5);
+	if(avx && avx2 && (_xgetbv(0) & 6) == 6)
+		return AVX2;
+	return SSE2;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2")? AVX2 : SSE2;
+#endif
+#elif defined(CRT_NEON)
+	return NEON;
+#else
+	return SCALAR;
+#endif
+}
+
+//each kernel processes as many elements as it can and returns the count, the caller completes the rest.
+
+#ifdef CRT_X86
+
+static inline __m128i blend(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static uint32_t scaleSSE2(const int32_t *in, float *out, uint32_t n, float q) {
+	__m128 vq = _mm_set1_ps(q);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), vq));
+	}
+	return i;
+}
+
+CRT_AVX2 static uint32_t scaleAVX2(const int32_t *in, float *out, uint32_t n, float q) {
+	__m256 vq = _mm256_set1_ps(q);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), vq));
+	}
+	return i;
+}
+
+//colors are packed as 4 bytes per 32 bit lane, qe and qo hold the qc of even and odd bytes in 16 bit lanes.
+static uint32_t toRGBSSE2(uchar *colors, uint32_t n, const int *qc) {
+	__m128i qe = _mm_setr_epi16(qc[0], qc[2], qc[0], qc[2], qc[0], qc[2], qc[0], qc[2]);
+	__m128i qo = _mm_setr_epi16(qc[1], qc[3], qc[1], qc[3], qc[1], qc[3], qc[1], qc[3]);
+	__m128i byte0 = _mm_set1_epi32(0xff);
+	__m128i byte1 = _mm_set1_epi32(0xff00);
+	__m128i byte3 = _mm_set1_epi32((int)0xff000000);
+	__m128i low = _mm_set1_epi16(0xff);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(colors + i*4));
+		//y y y 0 + v 0 u a
+		__m128i y = _mm_and_si128(c, byte0);
+		y = _mm_or_si128(y, _mm_or_si128(_mm_slli_epi32(y, 8), _mm_slli_epi32(y, 16)));
+		__m128i uv = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 16), byte0), _mm_slli_epi32(_mm_and_si128(c, byte1), 8));
+		c = _mm_add_epi8(y, _mm_or_si128(uv, _mm_and_si128(c, byte3)));
+
+		__m128i even = _mm_mullo_epi16(_mm_and_si128(c, low), qe);
+		__m128i odd = _mm_mullo_epi16(_mm_srli_epi16(c, 8), qo);
+		c = _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi16(odd, 8));
+		_mm_storeu_si128((__m128i *)(colors + i*4), c);
+	}
+	return i;
+}
+
+CRT_AVX2 static uint32_t toRGBAVX2(uchar *colors, uint32_t n, const int *qc) {
+	__m256i qe = _mm256_set1_epi32((qc[2] << 16) | qc[0]);
+	__m256i qo = _mm256_set1_epi32((qc[3] << 16) | qc[1]);
+	__m256i byte0 = _mm256_set1_epi32(0xff);
+	__m256i byte1 = _mm256_set1_epi32(0xff00);
+	__m256i byte3 = _mm256_set1_epi32((int)0xff000000);
+	__m256i low = _mm256_set1_epi16(0xff);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(colors + i*4));
+		__m256i y = _mm256_and_si256(c, byte0);
+		y = _mm256_or_si256(y, _mm256_or_si256(_mm256_slli_epi32(y, 8), _mm256_slli_epi32(y, 16)));
+		__m256i uv = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, 16), byte0), _mm256_slli_epi32(_mm256_and_si256(c, byte1), 8));
+		c = _mm256_add_epi8(y, _mm256_or_si256(uv, _mm256_and_si256(c, byte3)));
+
+		__m256i even = _mm256_mullo_epi16(_mm256_and_si256(c, low), qe);
+		__m256i odd = _mm256_mullo_epi16(_mm256_srli_epi16(c, 8), qo);
+		c = _mm256_or_si256(_mm256_and_si256(even, low), _mm256_slli_epi16(odd, 8));
+		_mm256_storeu_si256((__m256i *)(colors + i*4), c);
+	}
+	return i;
+}
+
+//division by a power of two qc as a 16 bit multiplication by 256/qc and a shift, false for other qc.
+static bool divisors(const int *qc, int *m) {
+	for(int k = 0; k < 4; k++) {
+		if(qc[k] <= 0 || qc[k] > 256 || (qc[k] & (qc[k] - 1)))
+			return false;
+		m[k] = 256/qc[k];
+	}
+	return true;
+}
+
+static uint32_t toYCCSSE2(uchar *colors, uint32_t n, const int *qc) {
+	int m[4];
+	if(!divisors(qc, m))
+		return 0;
+	__m128i me = _mm_setr_epi16(m[0], m[2], m[0], m[2], m[0], m[2], m[0], m[2]);
+	__m128i mo = _mm_setr_epi16(m[1], m[3], m[1], m[3], m[1], m[3], m[1], m[3]);
+	__m128i byte0 = _mm_set1_epi32(0xff);
+	__m128i byte1 = _mm_set1_epi32(0xff00);
+	__m128i byte2 = _mm_set1_epi32(0xff0000);
+	__m128i byte3 = _mm_set1_epi32((int)0xff000000);
+	__m128i low = _mm_set1_epi16(0xff);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(colors + i*4));
+		__m128i even = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(c, low), me), 8);
+		__m128i odd = _mm_srli_epi16(_mm_mullo_epi16(_mm_srli_epi16(c, 8), mo), 8);
+		c = _mm_or_si128(even, _mm_slli_epi16(odd, 8));
+		//g b r a - 0 g g 0
+		__m128i g = _mm_and_si128(_mm_srli_epi32(c, 8), byte0);
+		__m128i t = _mm_or_si128(_mm_or_si128(g, _mm_and_si128(_mm_srli_epi32(c, 8), byte1)),
+								 _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 16), byte2), _mm_and_si128(c, byte3)));
+		c = _mm_sub_epi8(t, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(g, 16)));
+		_mm_storeu_si128((__m128i *)(colors + i*4), c);
+	}
+	return i;
+}
+
+CRT_AVX2 static uint32_t toYCCAVX2(uchar *colors, uint32_t n, const int *qc) {
+	int m[4];
+	if(!divisors(qc, m))
+		return 0;
+	__m256i me = _mm256_set1_epi32((m[2] << 16) | m[0]);
+	__m256i mo = _mm256_set1_epi32((m[3] << 16) | m[1]);
+	__m256i byte0 = _mm256_set1_epi32(0xff);
+	__m256i byte1 = _mm256_set1_epi32(0xff00);
+	__m256i byte2 = _mm256_set1_epi32(0xff0000);
+	__m256i byte3 = _mm256_set1_epi32((int)0xff000000);
+	__m256i low = _mm256_set1_epi16(0xff);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(colors + i*4));
+		__m256i even = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(c, low), me), 8);
+		__m256i odd = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_srli_epi16(c, 8), mo), 8);
+		c = _mm256_or_si256(even, _mm256_slli_epi16(odd, 8));
+		__m256i g = _mm256_and_si256(_mm256_srli_epi32(c, 8), byte0);
+		__m256i t = _mm256_or_si256(_mm256_or_si256(g, _mm256_and_si256(_mm256_srli_epi32(c, 8), byte1)),
+									_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(c, 16), byte2), _mm256_and_si256(c, byte3)));
+		c = _mm256_sub_epi8(t, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(g, 16)));
+		_mm256_storeu_si256((__m256i *)(colors + i*4), c);
+	}
+	return i;
+}
+
+static uint32_t toFloatSSE2(const uchar *in, float *out, uint32_t n) {
+	__m128i zero = _mm_setzero_si128();
+	__m128 d = _mm_set1_ps(255.0f);
+	uint32_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i lo = _mm_unpacklo_epi8(c, zero);
+		__m128i hi = _mm_unpackhi_epi8(c, zero);
+		_mm_storeu_ps(out + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), d));
+		_mm_storeu_ps(out + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), d));
+		_mm_storeu_ps(out + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), d));
+		_mm_storeu_ps(out + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), d));
+	}
+	return i;
+}
+
+CRT_AVX2 static uint32_t toFloatAVX2(const uchar *in, float *out, uint32_t n) {
+	__m256 d = _mm256_set1_ps(255.0f);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_cvtepi32_ps(c), d));
+	}
+	return i;
+}
+
+//running sum of rows of N components: each row adds the previous one, sum holds the row before the first.
+static uint32_t prefixSumSSE2(int32_t *values, uint32_t n, int N, int32_t *sum) {
+	uint32_t i = 0;
+	__m128i carry = _mm_setr_epi32(sum[0], N > 1? sum[1] : 0, N > 2? sum[2] : 0, N > 3? sum[3] : 0);
+	switch(N) {
+	case 1:
+		carry = _mm_shuffle_epi32(carry, 0);
+		for(; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi32(v, carry);
+			_mm_storeu_si128((__m128i *)(values + i), v);
+			carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+		}
+		break;
+	case 2:
+		carry = _mm_shuffle_epi32(carry, _MM_SHUFFLE(1, 0, 1, 0));
+		for(; i + 2 <= n; i += 2) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(values + i*2));
+			v = _mm_add_epi32(_mm_add_epi32(v, _mm_slli_si128(v, 8)), carry);
+			_mm_storeu_si128((__m128i *)(values + i*2), v);
+			carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2));
+		}
+		break;
+	case 3: { //4 rows in 3 registers: shifted to one row per register, summed and packed back (the 4th lane is ignored).
+		__m128i low1 = _mm_setr_epi32(-1, 0, 0, 0);
+		__m128i low2 = _mm_setr_epi32(-1, -1, 0, 0);
+		__m128i low3 = _mm_setr_epi32(-1, -1, -1, 0);
+		for(; i + 4 <= n; i += 4) {
+			int32_t *p = values + i*3;
+			__m128i v0 = _mm_loadu_si128((const __m128i *)p);
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(p + 4));
+			__m128i v2 = _mm_loadu_si128((const __m128i *)(p + 8));
+			__m128i r0 = _mm_add_epi32(carry, v0);
+			__m128i r1 = _mm_add_epi32(r0, _mm_or_si128(_mm_srli_si128(v0, 12), _mm_slli_si128(v1, 4)));
+			__m128i r2 = _mm_add_epi32(r1, _mm_or_si128(_mm_srli_si128(v1, 8), _mm_slli_si128(v2, 8)));
+			__m128i r3 = _mm_add_epi32(r2, _mm_srli_si128(v2, 4));
+			_mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_and_si128(r0, low3), _mm_slli_si128(r1, 12)));
+			_mm_storeu_si128((__m128i *)(p + 4), _mm_or_si128(_mm_and_si128(_mm_srli_si128(r1, 4), low2), _mm_slli_si128(r2, 8)));
+			_mm_storeu_si128((__m128i *)(p + 8), _mm_or_si128(_mm_and_si128(_mm_srli_si128(r2, 8), low1), _mm_slli_si128(r3, 4)));
+			carry = r3;
+		}
+		break;
+	}
+	case 4:
+		for(; i < n; i++) {
+			carry = _mm_add_epi32(carry, _mm_loadu_si128((const __m128i *)(values + i*4)));
+			_mm_storeu_si128((__m128i *)(values + i*4), carry);
+		}
+		break;
+	default:
+		return 0;
+	}
+	int32_t last[4];
+	_mm_storeu_si128((__m128i *)last, carry);
+	for(int c = 0; c < N; c++)
+		sum[c] = last[c];
+	return i;
+}
+
+//integer part of toSphere on 4 octahedral pairs: x, y, z before normalization.
+static inline void octaSSE2(__m128i u, __m128i v, __m128i unit, __m128 &x, __m128 &y, __m128 &z) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i su = _mm_srai_epi32(u, 31);
+	__m128i sv = _mm_srai_epi32(v, 31);
+	__m128i au = _mm_sub_epi32(_mm_xor_si128(u, su), su);
+	__m128i av = _mm_sub_epi32(_mm_xor_si128(v, sv), sv);
+	__m128i iz = _mm_sub_epi32(_mm_sub_epi32(unit, au), av);
+	__m128i folded = _mm_cmplt_epi32(iz, zero);
+
+	__m128i tx = _mm_sub_epi32(unit, av);
+	__m128i ty = _mm_sub_epi32(unit, au);
+	tx = blend(_mm_cmpgt_epi32(u, zero), tx, _mm_sub_epi32(zero, tx));
+	ty = blend(_mm_cmpgt_epi32(v, zero), ty, _mm_sub_epi32(zero, ty));
+	x = _mm_cvtepi32_ps(blend(folded, tx, u));
+	y = _mm_cvtepi32_ps(blend(folded, ty, v));
+	z = _mm_cvtepi32_ps(iz);
+}
+
+//same association order as Point3::norm, float sqrt equals the double sqrt rounded to float.
+static inline void normalizeSSE2(__m128 &x, __m128 &y, __m128 &z) {
+	__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+	x = _mm_div_ps(x, len);
+	y = _mm_div_ps(y, len);
+	z = _mm_div_ps(z, len);
+}
+
+//store 4 normals writing one extra component past the end (which must be overwritten later).
+static inline void store(float *out, __m128 x, __m128 y, __m128 z) {
+	__m128 w = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(out, x);
+	_mm_storeu_ps(out + 3, y);
+	_mm_storeu_ps(out + 6, z);
+	_mm_storeu_ps(out + 9, w);
+}
+
+static inline void store(int16_t *out, __m128 x, __m128 y, __m128 z) {
+	__m128 s = _mm_set1_ps(32767.0f);
+	x = _mm_castsi128_ps(_mm_cvttps_epi32(_mm_mul_ps(x, s)));
+	y = _mm_castsi128_ps(_mm_cvttps_epi32(_mm_mul_ps(y, s)));
+	z = _mm_castsi128_ps(_mm_cvttps_epi32(_mm_mul_ps(z, s)));
+	__m128 w = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	__m128i a = _mm_packs_epi32(_mm_castps_si128(x), _mm_castps_si128(y));
+	__m128i b = _mm_packs_epi32(_mm_castps_si128(z), _mm_castps_si128(w));
+	_mm_storel_epi64((__m128i *)out, a);
+	_mm_storel_epi64((__m128i *)(out + 3), _mm_unpackhi_epi64(a, a));
+	_mm_storel_epi64((__m128i *)(out + 6), b);
+	_mm_storel_epi64((__m128i *)(out + 9), _mm_unpackhi_epi64(b, b));
+}
+
+//Point2s truncates the octahedral coordinates to 16 bits.
+static inline __m128i truncate16(__m128i u) { return _mm_srai_epi32(_mm_slli_epi32(u, 16), 16); }
+
+template <class S> uint32_t toSphereSSE2(const int32_t *octa, S *out, uint32_t n, int unit, bool short_octa) {
+	__m128i vunit = _mm_set1_epi32(unit);
+	uint32_t i = 0;
+	for(; i + 4 < n; i += 4) {
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(octa + i*2)));
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(octa + i*2 + 4)));
+		__m128i u = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i v = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		if(short_octa) {
+			u = truncate16(u);
+			v = truncate16(v);
+		}
+		__m128 x, y, z;
+		octaSSE2(u, v, vunit, x, y, z);
+		normalizeSSE2(x, y, z);
+		store(out + i*3, x, y, z);
+	}
+	return i;
+}
+
+CRT_AVX2 static inline __m256i blend(__m256i mask, __m256i a, __m256i b) {
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+template <class S> CRT_AVX2 uint32_t toSphereAVX2(const int32_t *octa, S *out, uint32_t n, int unit, bool short_octa) {
+	__m256i vunit = _mm256_set1_epi32(unit);
+	__m256i zero = _mm256_setzero_si256();
+	uint32_t i = 0;
+	for(; i + 8 < n; i += 8) {
+		__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(octa + i*2)));
+		__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(octa + i*2 + 8)));
+		//shuffle works within 128 bit lanes: fix the order of the 64 bit blocks
+		__m256i u = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i v = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0));
+		if(short_octa) {
+			u = _mm256_srai_epi32(_mm256_slli_epi32(u, 16), 16);
+			v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		}
+		__m256i au = _mm256_abs_epi32(u);
+		__m256i av = _mm256_abs_epi32(v);
+		__m256i iz = _mm256_sub_epi32(_mm256_sub_epi32(vunit, au), av);
+		__m256i folded = _mm256_cmpgt_epi32(zero, iz);
+
+		__m256i tx = _mm256_sub_epi32(vunit, av);
+		__m256i ty = _mm256_sub_epi32(vunit, au);
+		tx = blend(_mm256_cmpgt_epi32(u, zero), tx, _mm256_sub_epi32(zero, tx));
+		ty = blend(_mm256_cmpgt_epi32(v, zero), ty, _mm256_sub_epi32(zero, ty));
+		__m256 x = _mm256_cvtepi32_ps(blend(folded, tx, u));
+		__m256 y = _mm256_cvtepi32_ps(blend(folded, ty, v));
+		__m256 z = _mm256_cvtepi32_ps(iz);
+
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+		x = _mm256_div_ps(x, len);
+		y = _mm256_div_ps(y, len);
+		z = _mm256_div_ps(z, len);
+
+		store(out + i*3, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+		store(out + i*3 + 12, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+	}
+	return i;
+}
+
+//4 Point3f to x, y, z vectors.
+static inline void loadPoints(const float *p, __m128 &x, __m128 &y, __m128 &z) {
+	__m128 a = _mm_loadu_ps(p);     //x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(p + 4); //y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(p + 8); //z2 x3 y3 z3
+	x = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 2, 3, 0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+//the lower hemisphere is folded keeping the sign of x and y, zero counts as positive as in the scalar code.
+static uint32_t toOctaSSE2(const Point3f *normals, int32_t *octa, uint32_t n, int unit) {
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 vunit = _mm_set1_ps((float)unit);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128 x, y, z;
+		loadPoints((const float *)(normals + i), x, y, z);
+		__m128 len = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, x), _mm_andnot_ps(sign, y)), _mm_andnot_ps(sign, z));
+		__m128 px = _mm_div_ps(x, len);
+		__m128 py = _mm_div_ps(y, len);
+		__m128 fx = _mm_sub_ps(one, _mm_andnot_ps(sign, py));
+		__m128 fy = _mm_sub_ps(one, _mm_andnot_ps(sign, px));
+		fx = _mm_xor_ps(fx, _mm_and_ps(_mm_cmplt_ps(x, zero), sign));
+		fy = _mm_xor_ps(fy, _mm_and_ps(_mm_cmplt_ps(y, zero), sign));
+		__m128 folded = _mm_cmplt_ps(z, zero);
+		px = _mm_or_ps(_mm_and_ps(folded, fx), _mm_andnot_ps(folded, px));
+		py = _mm_or_ps(_mm_and_ps(folded, fy), _mm_andnot_ps(folded, py));
+		__m128i u = _mm_cvttps_epi32(_mm_mul_ps(px, vunit));
+		__m128i v = _mm_cvttps_epi32(_mm_mul_ps(py, vunit));
+		_mm_storeu_si128((__m128i *)(octa + i*2), _mm_unpacklo_epi32(u, v));
+		_mm_storeu_si128((__m128i *)(octa + i*2 + 4), _mm_unpackhi_epi32(u, v));
+	}
+	return i;
+}
+
+CRT_AVX2 static uint32_t toOctaAVX2(const Point3f *normals, int32_t *octa, uint32_t n, int unit) {
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 vunit = _mm256_set1_ps((float)unit);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m128 x0, y0, z0, x1, y1, z1;
+		loadPoints((const float *)(normals + i), x0, y0, z0);
+		loadPoints((const float *)(normals + i + 4), x1, y1, z1);
+		__m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+		__m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+		__m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+		__m256 len = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(sign, x), _mm256_andnot_ps(sign, y)), _mm256_andnot_ps(sign, z));
+		__m256 px = _mm256_div_ps(x, len);
+		__m256 py = _mm256_div_ps(y, len);
+		__m256 fx = _mm256_sub_ps(one, _mm256_andnot_ps(sign, py));
+		__m256 fy = _mm256_sub_ps(one, _mm256_andnot_ps(sign, px));
+		fx = _mm256_xor_ps(fx, _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), sign));
+		fy = _mm256_xor_ps(fy, _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), sign));
+		__m256 folded = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+		px = _mm256_blendv_ps(px, fx, folded);
+		py = _mm256_blendv_ps(py, fy, folded);
+		__m256i u = _mm256_cvttps_epi32(_mm256_mul_ps(px, vunit));
+		__m256i v = _mm256_cvttps_epi32(_mm256_mul_ps(py, vunit));
+		//unpack works within 128 bit lanes.
+		__m256i lo = _mm256_unpacklo_epi32(u, v);
+		__m256i hi = _mm256_unpackhi_epi32(u, v);
+		_mm256_storeu_si256((__m256i *)(octa + i*2), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(octa + i*2 + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return i;
+}
+
+#endif
+
+#ifdef CRT_NEON
+
+static uint32_t scaleNEON(const int32_t *in, float *out, uint32_t n, float q) {
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4)
+		vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)), q));
+	return i;
+}
+
+static uint32_t toRGBNEON(uchar *colors, uint32_t n, const int *qc) {
+	uint8x16_t q0 = vdupq_n_u8((uint8_t)qc[0]);
+	uint8x16_t q1 = vdupq_n_u8((uint8_t)qc[1]);
+	uint8x16_t q2 = vdupq_n_u8((uint8_t)qc[2]);
+	uint8x16_t q3 = vdupq_n_u8((uint8_t)qc[3]);
+	uint32_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		uint8x16x4_t c = vld4q_u8(colors + i*4);
+		uint8x16x4_t rgb;
+		rgb.val[0] = vmulq_u8(vaddq_u8(c.val[2], c.val[0]), q0);
+		rgb.val[1] = vmulq_u8(c.val[0], q1);
+		rgb.val[2] = vmulq_u8(vaddq_u8(c.val[1], c.val[0]), q2);
+		rgb.val[3] = vmulq_u8(c.val[3], q3);
+		vst4q_u8(colors + i*4, rgb);
+	}
+	return i;
+}
+
+static uint32_t toYCCNEON(uchar *colors, uint32_t n, const int *qc) {
+	int8x16_t shift[4];
+	for(int k = 0; k < 4; k++) {
+		if(qc[k] <= 0 || qc[k] > 256 || (qc[k] & (qc[k] - 1)))
+			return 0;
+		int s = 0;
+		while((1 << s) < qc[k]) s++;
+		shift[k] = vdupq_n_s8((int8_t)-s);
+	}
+	uint32_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		uint8x16x4_t c = vld4q_u8(colors + i*4);
+		for(int k = 0; k < 4; k++)
+			c.val[k] = vshlq_u8(c.val[k], shift[k]);
+		uint8x16x4_t ycc;
+		ycc.val[0] = c.val[1];
+		ycc.val[1] = vsubq_u8(c.val[2], c.val[1]);
+		ycc.val[2] = vsubq_u8(c.val[0], c.val[1]);
+		ycc.val[3] = c.val[3];
+		vst4q_u8(colors + i*4, ycc);
+	}
+	return i;
+}
+
+static uint32_t toFloatNEON(const uchar *in, float *out, uint32_t n) {
+	float32x4_t d = vdupq_n_f32(255.0f);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		uint16x8_t c = vmovl_u8(vld1_u8(in + i));
+		vst1q_f32(out + i, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(c))), d));
+		vst1q_f32(out + i + 4, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(c))), d));
+	}
+	return i;
+}
+
+//same as prefixSumSSE2, vext shifts lanes across registers.
+static uint32_t prefixSumNEON(int32_t *values, uint32_t n, int N, int32_t *sum) {
+	uint32_t i = 0;
+	int32_t first[4] = { sum[0], N > 1? sum[1] : 0, N > 2? sum[2] : 0, N > 3? sum[3] : 0 };
+	int32x4_t carry = vld1q_s32(first);
+	int32x4_t zero = vdupq_n_s32(0);
+	switch(N) {
+	case 1:
+		carry = vdupq_n_s32(sum[0]);
+		for(; i + 4 <= n; i += 4) {
+			int32x4_t v = vld1q_s32(values + i);
+			v = vaddq_s32(v, vextq_s32(zero, v, 3));
+			v = vaddq_s32(v, vextq_s32(zero, v, 2));
+			v = vaddq_s32(v, carry);
+			vst1q_s32(values + i, v);
+			carry = vdupq_n_s32(vgetq_lane_s32(v, 3));
+		}
+		break;
+	case 2:
+		carry = vcombine_s32(vget_low_s32(carry), vget_low_s32(carry));
+		for(; i + 2 <= n; i += 2) {
+			int32x4_t v = vld1q_s32(values + i*2);
+			v = vaddq_s32(vaddq_s32(v, vextq_s32(zero, v, 2)), carry);
+			vst1q_s32(values + i*2, v);
+			carry = vcombine_s32(vget_high_s32(v), vget_high_s32(v));
+		}
+		break;
+	case 3:
+		for(; i + 4 <= n; i += 4) {
+			int32_t *p = values + i*3;
+			int32x4_t v0 = vld1q_s32(p);
+			int32x4_t v1 = vld1q_s32(p + 4);
+			int32x4_t v2 = vld1q_s32(p + 8);
+			int32x4_t r0 = vaddq_s32(carry, v0);
+			int32x4_t r1 = vaddq_s32(r0, vextq_s32(v0, v1, 3));
+			int32x4_t r2 = vaddq_s32(r1, vextq_s32(v1, v2, 2));
+			int32x4_t r3 = vaddq_s32(r2, vextq_s32(v2, v2, 1));
+			vst1q_s32(p, vsetq_lane_s32(vgetq_lane_s32(r1, 0), r0, 3));
+			vst1q_s32(p + 4, vcombine_s32(vget_low_s32(vextq_s32(r1, r1, 1)), vget_low_s32(r2)));
+			vst1q_s32(p + 8, vextq_s32(vextq_s32(r2, r2, 3), r3, 3));
+			carry = r3;
+		}
+		break;
+	case 4:
+		for(; i < n; i++) {
+			carry = vaddq_s32(carry, vld1q_s32(values + i*4));
+			vst1q_s32(values + i*4, carry);
+		}
+		break;
+	default:
+		return 0;
+	}
+	int32_t last[4];
+	vst1q_s32(last, carry);
+	for(int c = 0; c < N; c++)
+		sum[c] = last[c];
+	return i;
+}
+
+static inline void octaNEON(const int32_t *octa, int32x4_t unit, bool short_octa, float32x4_t &x, float32x4_t &y, float32x4_t &z) {
+	int32x4x2_t p = vld2q_s32(octa);
+	int32x4_t u = p.val[0];
+	int32x4_t v = p.val[1];
+	if(short_octa) {
+		u = vmovl_s16(vmovn_s32(u));
+		v = vmovl_s16(vmovn_s32(v));
+	}
+	int32x4_t zero = vdupq_n_s32(0);
+	int32x4_t au = vabsq_s32(u);
+	int32x4_t av = vabsq_s32(v);
+	int32x4_t iz = vsubq_s32(vsubq_s32(unit, au), av);
+	uint32x4_t folded = vcltq_s32(iz, zero);
+
+	int32x4_t tx = vsubq_s32(unit, av);
+	int32x4_t ty = vsubq_s32(unit, au);
+	tx = vbslq_s32(vcgtq_s32(u, zero), tx, vnegq_s32(tx));
+	ty = vbslq_s32(vcgtq_s32(v, zero), ty, vnegq_s32(ty));
+	x = vcvtq_f32_s32(vbslq_s32(folded, tx, u));
+	y = vcvtq_f32_s32(vbslq_s32(folded, ty, v));
+	z = vcvtq_f32_s32(iz);
+
+	float32x4_t len = vsqrtq_f32(vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)), vmulq_f32(z, z)));
+	x = vdivq_f32(x, len);
+	y = vdivq_f32(y, len);
+	z = vdivq_f32(z, len);
+}
+
+static uint32_t toSphereNEON(const int32_t *octa, Point3f *out, uint32_t n, int unit) {
+	int32x4_t vunit = vdupq_n_s32(unit);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		float32x4x3_t p;
+		octaNEON(octa + i*2, vunit, false, p.val[0], p.val[1], p.val[2]);
+		vst3q_f32((float *)(out + i), p);
+	}
+	return i;
+}
+
+static uint32_t toSphereNEON(const int32_t *octa, Point3s *out, uint32_t n, int unit) {
+	int32x4_t vunit = vdupq_n_s32(unit);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		float32x4_t x, y, z;
+		octaNEON(octa + i*2, vunit, true, x, y, z);
+		int16x4x3_t p;
+		p.val[0] = vmovn_s32(vcvtq_s32_f32(vmulq_n_f32(x, 32767.0f)));
+		p.val[1] = vmovn_s32(vcvtq_s32_f32(vmulq_n_f32(y, 32767.0f)));
+		p.val[2] = vmovn_s32(vcvtq_s32_f32(vmulq_n_f32(z, 32767.0f)));
+		vst3_s16((int16_t *)(out + i), p);
+	}
+	return i;
+}
+
+static uint32_t toOctaNEON(const Point3f *normals, int32_t *octa, uint32_t n, int unit) {
+	float32x4_t zero = vdupq_n_f32(0.0f);
+	float32x4_t one = vdupq_n_f32(1.0f);
+	float vunit = (float)unit;
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		float32x4x3_t p = vld3q_f32((const float *)(normals + i));
+		float32x4_t x = p.val[0], y = p.val[1], z = p.val[2];
+		float32x4_t len = vaddq_f32(vaddq_f32(vabsq_f32(x), vabsq_f32(y)), vabsq_f32(z));
+		float32x4_t px = vdivq_f32(x, len);
+		float32x4_t py = vdivq_f32(y, len);
+		float32x4_t fx = vsubq_f32(one, vabsq_f32(py));
+		float32x4_t fy = vsubq_f32(one, vabsq_f32(px));
+		fx = vbslq_f32(vcltq_f32(x, zero), vnegq_f32(fx), fx);
+		fy = vbslq_f32(vcltq_f32(y, zero), vnegq_f32(fy), fy);
+		uint32x4_t folded = vcltq_f32(z, zero);
+		int32x4x2_t o;
+		o.val[0] = vcvtq_s32_f32(vmulq_n_f32(vbslq_f32(folded, fx, px), vunit));
+		o.val[1] = vcvtq_s32_f32(vmulq_n_f32(vbslq_f32(folded, fy, py), vunit));
+		vst2q_s32(octa + i*2, o);
+	}
+	return i;
+}
+
+#endif
+
+void Simd::scale(const int32_t *in, float *out, uint32_t n, float q) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = scaleAVX2(in, out, n, q); break;
+	case SSE2: i = scaleSSE2(in, out, n, q); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = scaleNEON(in, out, n, q); break;
+#endif
+	default: break;
+	}
+	for(; i < n; i++)
+		out[i] = in[i]*q;
+}
+
+void Simd::toRGB(uchar *colors, uint32_t n, const int *qc) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toRGBAVX2(colors, n, qc); break;
+	case SSE2: i = toRGBSSE2(colors, n, qc); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toRGBNEON(colors, n, qc); break;
+#endif
+	default: break;
+	}
+	for(uchar *c = colors + i*4; i < n; i++, c += 4) {
+		Color4b color = Color4b(c[0], c[1], c[2], c[3]).toRGB();
+		for(int k = 0; k < 4; k++)
+			c[k] = color[k]*qc[k];
+	}
+}
+
+void Simd::toYCC(uchar *colors, uint32_t n, const int *qc) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toYCCAVX2(colors, n, qc); break;
+	case SSE2: i = toYCCSSE2(colors, n, qc); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toYCCNEON(colors, n, qc); break;
+#endif
+	default: break;
+	}
+	for(uchar *c = colors + i*4; i < n; i++, c += 4) {
+		Color4b color = Color4b(c[0]/qc[0], c[1]/qc[1], c[2]/qc[2], c[3]/qc[3]).toYCC();
+		for(int k = 0; k < 4; k++)
+			c[k] = color[k];
+	}
+}
+
+void Simd::toFloat(const uchar *in, float *out, uint32_t n) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toFloatAVX2(in, out, n); break;
+	case SSE2: i = toFloatSSE2(in, out, n); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toFloatNEON(in, out, n); break;
+#endif
+	default: break;
+	}
+	for(; i < n; i++)
+		out[i] = in[i]/255.0f;
+}
+
+void Simd::toSphere(const int32_t *octa, Point3f *normals, uint32_t n, int unit) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toSphereAVX2(octa, (float *)normals, n, unit, false); break;
+	case SSE2: i = toSphereSSE2(octa, (float *)normals, n, unit, false); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toSphereNEON(octa, normals, n, unit); break;
+#endif
+	default: break;
+	}
+	for(; i < n; i++)
+		normals[i] = NormalAttr::toSphere(Point2i(octa[i*2], octa[i*2 + 1]), unit);
+}
+
+void Simd::toSphere(const int32_t *octa, Point3s *normals, uint32_t n, int unit) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toSphereAVX2(octa, (int16_t *)normals, n, unit, true); break;
+	case SSE2: i = toSphereSSE2(octa, (int16_t *)normals, n, unit, true); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toSphereNEON(octa, normals, n, unit); break;
+#endif
+	default: break;
+	}
+	for(; i < n; i++)
+		normals[i] = NormalAttr::toSphere(Point2s(octa[i*2], octa[i*2 + 1]), unit);
+}
+
+void Simd::toOcta(const Point3f *normals, int32_t *octa, uint32_t n, int unit) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2: i = toOctaAVX2(normals, octa, n, unit); break;
+	case SSE2: i = toOctaSSE2(normals, octa, n, unit); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = toOctaNEON(normals, octa, n, unit); break;
+#endif
+	default: break;
+	}
+	for(; i < n; i++) {
+		Point2i o = NormalAttr::toOcta(normals[i], unit);
+		octa[i*2] = o[0];
+		octa[i*2 + 1] = o[1];
+	}
+}
+
+void Simd::prefixSum(int32_t *values, uint32_t n, int N, int32_t *sum) {
+	uint32_t i = 0;
+	switch(level) {
+#ifdef CRT_X86
+	case AVX2:
+	case SSE2: i = prefixSumSSE2(values, n, N, sum); break;
+#endif
+#ifdef CRT_NEON
+	case NEON: i = prefixSumNEON(values, n, N, sum); break;
+#endif
+	default: break;
+	}
+	for(int32_t *v = values + i*N; i < n; i++, v += N)
+		for(int c = 0; c < N; c++)
+			v[c] = sum[c] += v[c];
+}
@@ -0,0 +1,303 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+
+#include "tiles.h"
+#include "zpoint.h"
+#include "workers.h"
+
+using namespace crt;
+using namespace std;
+
+static const uint32_t tiles_magic = 0x787A6354;
+static const uint32_t tiles_version = 1;
+
+static void boundingBox(uint32_t nvert, const float *buffer, Point3f &min, Point3f &max) {
+	const Point3f *input = (const Point3f *)buffer;
+	min = Point3f(FLT_MAX);
+	max = Point3f(-FLT_MAX);
+	for(uint32_t i = 0; i < nvert; i++) {
+		min.setMin(input[i]);
+		max.setMax(input[i]);
+	}
+}
+
+//run job(i) for i in [0, n), on worker threads if more than 1.
+template <class F> static void runJobs(int threads, size_t n, F job) {
+#ifndef NO_THREADS
+	if(threads > 1 && n > 1) {
+		Workers workers;
+		workers.start(std::min<int>(threads, (int)n), n, job);
+		workers.join();
+		return;
+	}
+#endif
+	for(size_t i = 0; i < n; i++)
+		job(i);
+}
+
+TileEncoder::TileEncoder(uint32_t _nvert, uint32_t _max_points, Stream::Entropy _entropy):
+	nvert(_nvert), max_points(_max_points), threads(1), entropy(_entropy), positions(nullptr), q(0) {}
+
+bool TileEncoder::addPositions(const float *buffer, float _q) {
+	if(positions) return false;
+	positions = buffer;
+	q = _q;
+	if(q == 0) { //same estimate of Encoder::addPositions for point clouds, on the whole cloud.
+		Point3f min, max;
+		boundingBox(nvert, buffer, min, max);
+		max -= min;
+		q = 0.02*pow(max[0]*max[1]*max[2], 2.0/3.0)/nvert;
+	}
+	return true;
+}
+
+bool TileEncoder::addPositionsBits(const float *buffer, int bits) {
+	Point3f min, max;
+	boundingBox(nvert, buffer, min, max);
+	max -= min;
+	max /= pow(2.0f, (float)bits);
+	return addPositions(buffer, std::max(std::max(max[0], max[1]), max[2]));
+}
+
+bool TileEncoder::addNormals(const float *buffer, int bits) {
+	//estimated and border predictions need faces.
+	inputs.push_back(Input{ (const char *)buffer, 12, [bits](Encoder &encoder, const char *values) {
+		return encoder.addNormals((const float *)values, bits, NormalAttr::DIFF);
+	}});
+	return true;
+}
+
+bool TileEncoder::addColors(const unsigned char *buffer, int rbits, int gbits, int bbits, int abits) {
+	inputs.push_back(Input{ (const char *)buffer, 4, [=](Encoder &encoder, const char *values) {
+		return encoder.addColors((const unsigned char *)values, rbits, gbits, bbits, abits);
+	}});
+	return true;
+}
+
+bool TileEncoder::addColors3(const unsigned char *buffer, int rbits, int gbits, int bbits) {
+	inputs.push_back(Input{ (const char *)buffer, 3, [=](Encoder &encoder, const char *values) {
+		return encoder.addColors3((const unsigned char *)values, rbits, gbits, bbits);
+	}});
+	return true;
+}
+
+bool TileEncoder::addUvs(const float *buffer, float q) {
+	inputs.push_back(Input{ (const char *)buffer, 8, [q](Encoder &encoder, const char *values) {
+		return encoder.addUvs((const float *)values, q);
+	}});
+	return true;
+}
+
+bool TileEncoder::addAttribute(const char *name, const char *buffer, VertexAttribute::Format format, int components, float q, uint32_t strategy) {
+	std::string key(name);
+	uint32_t bytes = components*VertexAttribute::formatBytes(format);
+	inputs.push_back(Input{ buffer, bytes, [=](Encoder &encoder, const char *values) {
+		return encoder.addAttribute(key.c_str(), values, format, components, q, strategy);
+	}});
+	return true;
+}
+
+//octree cells in morton order, zpoints in [start, end) share the bits above shift.
+void TileEncoder::split(std::vector<std::pair<uint32_t, uint32_t> > &cells, const std::vector<ZPoint> &zpoints, uint32_t start, uint32_t end, int shift) {
+	if(end - start <= max_points || shift == 0) {
+		cells.push_back(std::make_pair(start, end));
+		return;
+	}
+	shift -= 3;
+	uint32_t i = start;
+	while(i < end) {
+		uint64_t cell = zpoints[i].bits >> shift;
+		uint32_t j = i + 1;
+		while(j < end && (zpoints[j].bits >> shift) == cell)
+			j++;
+		split(cells, zpoints, i, j, shift);
+		i = j;
+	}
+}
+
+void TileEncoder::encode() {
+#ifndef NO_EXCEPTIONS
+	if(!positions)
+		throw "No positions added.";
+#endif
+	//bucketing uses its own 21 bits grid, independent of the quantization.
+	Point3f min, max;
+	boundingBox(nvert, positions, min, max);
+	Point3f side = max - min;
+	float largest = std::max(std::max(side[0], side[1]), side[2]);
+	float scale = largest > 0? 0x1fffff/largest : 0;
+
+	const Point3f *coords = (const Point3f *)positions;
+	std::vector<ZPoint> zpoints(nvert);
+	parallelFor(threads, nvert, [&](uint32_t start, uint32_t end) {
+		for(uint32_t i = start; i < end; i++) {
+			Point3f p = (coords[i] - min)*scale;
+			zpoints[i] = ZPoint((uint64_t)p[0], (uint64_t)p[1], (uint64_t)p[2], 21, i);
+		}
+	});
+	radixSort(zpoints, threads);
+
+	std::vector<std::pair<uint32_t, uint32_t> > cells;
+	if(nvert)
+		split(cells, zpoints, 0, nvert, 63);
+
+	tiles.resize(cells.size());
+	std::vector<std::vector<uchar> > parts(cells.size());
+	runJobs(threads, cells.size(), [&](size_t t) {
+		uint32_t start = cells[t].first;
+		uint32_t count = cells[t].second - start;
+
+		std::vector<Point3f> points(count);
+		for(uint32_t i = 0; i < count; i++)
+			points[i] = coords[zpoints[start + i].pos];
+
+		Encoder encoder(count, 0, entropy);
+		encoder.exif = exif;
+		encoder.addPositions((float *)points.data(), q);
+
+		std::vector<char> values;
+		for(Input &input: inputs) {
+			values.resize((size_t)count*input.bytes);
+			for(uint32_t i = 0; i < count; i++)
+				memcpy(&values[(size_t)i*input.bytes], input.buffer + (size_t)zpoints[start + i].pos*input.bytes, input.bytes);
+			input.add(encoder, values.data());
+		}
+		encoder.encode();
+
+		Tile &tile = tiles[t];
+		boundingBox(count, (float *)points.data(), tile.min, tile.max);
+		tile.nvert = encoder.nvert;
+		parts[t].assign(encoder.stream.data(), encoder.stream.data() + encoder.stream.size());
+	});
+
+	stream.write<uint32_t>(tiles_magic);
+	stream.write<uint32_t>(tiles_version);
+	stream.write<uint32_t>((uint32_t)tiles.size());
+	size_t offset = stream.size() + tiles.size()*(6*sizeof(float) + 3*sizeof(uint32_t));
+	for(size_t t = 0; t < tiles.size(); t++) {
+		Tile &tile = tiles[t];
+		tile.offset = OutStream::offset32(offset);
+		tile.length = OutStream::offset32(parts[t].size());
+		offset += (parts[t].size() + 3) & ~(size_t)3; //javascript decoders need 4 bytes alignment.
+
+		for(int k = 0; k < 3; k++)
+			stream.write<float>(tile.min[k]);
+		for(int k = 0; k < 3; k++)
+			stream.write<float>(tile.max[k]);
+		stream.write<uint32_t>(tile.nvert);
+		stream.write<uint32_t>(tile.offset);
+		stream.write<uint32_t>(tile.length);
+	}
+	for(size_t t = 0; t < tiles.size(); t++) {
+		stream.push(parts[t].data(), parts[t].size());
+		stream.grow(tiles[t].offset + (((size_t)tiles[t].length + 3) & ~(size_t)3) - stream.size());
+	}
+	stream.flush();
+}
+
+
+TileDecoder::TileDecoder(size_t len, const uchar *_input): nvert(0), threads(1), input(_input) {
+	InStream stream;
+	stream.init(len, input);
+	uint32_t magic = stream.readUint32();
+#ifndef NO_EXCEPTIONS
+	if(magic != tiles_magic)
+		throw "Not a tiled crt file.";
+#endif
+	uint32_t version = stream.readUint32();
+#ifndef NO_EXCEPTIONS
+	if(version > tiles_version)
+		throw "Unsupported tiled crt version.";
+#endif
+	tiles.resize(stream.readUint32());
+	for(Tile &tile: tiles) {
+		for(int k = 0; k < 3; k++)
+			tile.min[k] = stream.readFloat();
+		for(int k = 0; k < 3; k++)
+			tile.max[k] = stream.readFloat();
+		tile.nvert = stream.readUint32();
+		tile.offset = stream.readUint32();
+		tile.length = stream.readUint32();
+	}
+	for(uint32_t t = 0; t < tiles.size(); t++) {
+		selected.push_back(t);
+		nvert += tiles[t].nvert;
+	}
+	//tiles share the attributes.
+	if(tiles.size()) {
+		Decoder decoder(tiles[0].length, input + tiles[0].offset);
+		for(auto it: decoder.data)
+			attributes[it.first] = it.second->N;
+	}
+}
+
+uint32_t TileDecoder::select(const Point3f &min, const Point3f &max) {
+	selected.clear();
+	nvert = 0;
+	for(uint32_t t = 0; t < tiles.size(); t++) {
+		Tile &tile = tiles[t];
+		bool inside = true;
+		for(int k = 0; k < 3; k++)
+			inside = inside && tile.min[k] <= max[k] && tile.max[k] >= min[k];
+		if(!inside)
+			continue;
+		selected.push_back(t);
+		nvert += tile.nvert;
+	}
+	return nvert;
+}
+
+bool TileDecoder::setAttribute(const char *name, char *base, VertexAttribute::Format format, uint32_t stride, uint32_t offset) {
+	if(!hasAttr(name)) return false;
+	if(!stride) {
+		int n = (format == VertexAttribute::OCTA16 || format == VertexAttribute::OCTA32)? 2 : attributes[name];
+		stride = n*VertexAttribute::formatBytes(format);
+	}
+	outputs.push_back(Output{ name, base, format, stride, offset, 0 });
+	return true;
+}
+
+bool TileDecoder::setColors(uchar *base, int components, uint32_t stride, uint32_t offset) {
+	if(!hasAttr("color")) return false;
+	if(!stride)
+		stride = components;
+	outputs.push_back(Output{ "color", (char *)base, VertexAttribute::UINT8, stride, offset, components });
+	return true;
+}
+
+void TileDecoder::decode() {
+	std::vector<uint32_t> first(selected.size() + 1, 0);
+	for(size_t s = 0; s < selected.size(); s++)
+		first[s + 1] = first[s] + tiles[selected[s]].nvert;
+
+	runJobs(threads, selected.size(), [&](size_t s) {
+		Tile &tile = tiles[selected[s]];
+		Decoder decoder(tile.length, input + tile.offset);
+		decoder.threads = selected.size() == 1? threads : 1;
+		for(Output &output: outputs) {
+			char *base = output.base + (size_t)first[s]*output.stride;
+			if(output.components)
+				decoder.setColors((uchar *)base, output.components, output.stride, output.offset);
+			else
+				decoder.setAttribute(output.name.c_str(), base, output.format, output.stride, output.offset);
+		}
+		decoder.decode();
+	});
+}
@@ -0,0 +1,140 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <corto/encoder.h>
+#include <corto/decoder.h>
+
+using namespace crt;
+
+//threaded normal estimation: NormalAttr::estimateNormals and the estimated prediction of the
+//encoder and decoder, on a grid in scan order and with the vertices shuffled.
+//Every thread count must give the same bits as 1 thread.
+//usage: normals_bench [side] [max threads]
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Mesh {
+	std::vector<Point3f> coords;
+	std::vector<Point3f> normals;
+	std::vector<uint32_t> index;
+};
+
+static Mesh grid(uint32_t side, bool shuffle) {
+	Mesh mesh;
+	std::vector<uint32_t> order(side*side);
+	for(uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	if(shuffle)
+		std::shuffle(order.begin(), order.end(), std::mt19937(5));
+	mesh.coords.resize(order.size());
+	mesh.normals.resize(order.size());
+	for(uint32_t y = 0; y < side; y++)
+		for(uint32_t x = 0; x < side; x++) {
+			mesh.coords[order[y*side + x]] = Point3f(x, y, 3.0f*sinf(x*0.05f)*cosf(y*0.07f));
+			Point3f n(sinf(x*0.05f), cosf(y*0.07f), 2.0f);
+			mesh.normals[order[y*side + x]] = n/n.norm();
+		}
+	for(uint32_t y = 0; y + 1 < side; y++)
+		for(uint32_t x = 0; x + 1 < side; x++) {
+			uint32_t a = y*side + x;
+			uint32_t f[6] = { a, a + 1, a + side + 1, a, a + side + 1, a + side };
+			for(uint32_t v: f)
+				mesh.index.push_back(order[v]);
+		}
+	return mesh;
+}
+
+static int bench(const Mesh &mesh, const char *name, int max_threads) {
+	uint32_t nvert = mesh.coords.size();
+	uint32_t nface = mesh.index.size()/3;
+	int errors = 0;
+
+	std::vector<Point3f> serial;
+	for(int threads = 1; threads <= max_threads; threads++) {
+		std::vector<Point3f> normals(nvert);
+		auto start = std::chrono::steady_clock::now();
+		NormalAttr::estimateNormals(nvert, mesh.coords.data(), nface, mesh.index.data(), normals.data(), threads);
+		printf("%s, %d threads: estimateNormals %8.2f ms\n", name, threads, elapsed(start));
+		if(threads == 1)
+			serial = normals;
+		else if(memcmp(serial.data(), normals.data(), nvert*sizeof(Point3f))) {
+			printf("%s, %d threads: estimated normals differ from 1 thread\n", name, threads);
+			errors++;
+		}
+	}
+
+	std::vector<uchar> stream;
+	std::vector<Point3f> decoded;
+	for(int threads = 1; threads <= max_threads; threads++) {
+		auto start = std::chrono::steady_clock::now();
+		Encoder encoder(nvert, nface);
+		encoder.threads = threads;
+		encoder.addPositions((float *)mesh.coords.data(), mesh.index.data(), 0.01f);
+		encoder.addNormals((float *)mesh.normals.data(), 10, NormalAttr::ESTIMATED);
+		encoder.encode();
+		double encode = elapsed(start);
+
+		start = std::chrono::steady_clock::now();
+		std::vector<Point3f> positions(encoder.nvert);
+		std::vector<Point3f> normals(encoder.nvert);
+		std::vector<uint32_t> faces(encoder.nface*3);
+		Decoder decoder(encoder.stream.size(), encoder.stream.data());
+		decoder.threads = threads;
+		decoder.setIndex(faces.data());
+		decoder.setPositions((float *)positions.data());
+		decoder.setNormals((float *)normals.data());
+		decoder.decode();
+		printf("%s, %d threads: encode %8.2f ms, decode %8.2f ms\n", name, threads, encode, elapsed(start));
+
+		if(threads == 1) {
+			stream.assign(encoder.stream.data(), encoder.stream.data() + encoder.stream.size());
+			decoded = normals;
+			continue;
+		}
+		if(stream.size() != encoder.stream.size() || memcmp(stream.data(), encoder.stream.data(), stream.size())) {
+			printf("%s, %d threads: stream differs from 1 thread\n", name, threads);
+			errors++;
+		}
+		if(memcmp(decoded.data(), normals.data(), decoded.size()*sizeof(Point3f))) {
+			printf("%s, %d threads: decoded normals differ from 1 thread\n", name, threads);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t side = argc > 1? (uint32_t)atoi(argv[1]) : 1000;
+	int max_threads = argc > 2? atoi(argv[2]) : 4;
+	int errors = 0;
+	errors += bench(grid(side, false), "grid", max_threads);
+	errors += bench(grid(side, true), "shuffled", max_threads);
+	return errors? 1 : 0;
+}
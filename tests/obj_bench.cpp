@@ -0,0 +1,96 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "meshloader.h"
+#include "objload.h"
+
+using namespace crt;
+
+//obj loading: mapped parallel parser of MeshLoader against the istream parser of objload.h.
+//the grid has uvs, normals, quads, groups and materials, the models must be identical.
+//usage: obj_bench [side] [threads]
+
+static void writeGrid(const char *filename, int side) {
+	FILE *fp = fopen(filename, "wb");
+	fprintf(fp, "mtllib grid.mtl\n");
+	for(int y = 0; y < side; y++)
+		for(int x = 0; x < side; x++)
+			fprintf(fp, "v %f %f %f\r\n", x*0.013f, y*0.017f, (x*y % 7)*0.1f);
+	for(int y = 0; y < side; y++)
+		for(int x = 0; x < side; x++)
+			fprintf(fp, "vt %f %f\n", x/(float)side, y/(float)side);
+	fprintf(fp, "vn 0 0 1\nvn 0 0.6 0.8\n");
+	for(int y = 0; y + 1 < side; y++) {
+		if(y == 0 || y == side/2)
+			fprintf(fp, "g part%d\nusemtl mat%d\n", y, y);
+		for(int x = 0; x + 1 < side; x++) {
+			int a = y*side + x + 1, b = a + 1, c = a + side + 1, d = a + side;
+			int n = 1 + (x & 1);
+			if(x % 3)
+				fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, n, b, b, n, c, c, n, d, d, n);
+			else
+				fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d\nf %d/%d/%d %d/%d/%d %d/%d/%d\n",
+						a, a, n, b, b, n, c, c, n, a, a, n, c, c, n, d, d, n);
+		}
+	}
+	fclose(fp);
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	int side = argc > 1? atoi(argv[1]) : 1000;
+	int threads = argc > 2? atoi(argv[2]) : 1;
+	const char *filename = "obj_bench.obj";
+	writeGrid(filename, side);
+
+	auto start = std::chrono::steady_clock::now();
+	obj::IndexedModel model = obj::loadModelFromFile(filename);
+	printf("istream parser: %8.2f ms\n", elapsed(start));
+
+	int errors = 0;
+	for(int t: { 1, threads }) {
+		MeshLoader loader;
+		loader.threads = t;
+		start = std::chrono::steady_clock::now();
+		bool loaded = loader.load(filename);
+		printf("mapped parser, %d threads: %8.2f ms\n", t, elapsed(start));
+
+		bool blocks = loader.groups.size() == model.blocks.size();
+		for(size_t i = 0; blocks && i < model.blocks.size(); i++)
+			blocks = loader.groups[i].end == model.blocks[i].end &&
+					loader.groups[i].properties["material"] == model.blocks[i].material;
+		if(!loaded || loader.coords != model.vertex || loader.uvs != model.texCoord ||
+				loader.norms != model.normal || loader.index != model.faces || !blocks) {
+			printf("mapped parser, %d threads: model differs\n", t);
+			errors++;
+		}
+	}
+	remove(filename);
+	return errors? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#include <corto/encoder.h>
+#include <corto/decoder.h>
+
+using namespace crt;
+
+//OCTA32 output must match the float decode, also where the estimated normal is zero:
+//a grid plus a fan of faces with coincident vertices (zero area).
+//BORDER does not correct inner vertices: the float output is not quantized there, tolerance is larger.
+static int check(NormalAttr::Prediction prediction, const char *name, float tolerance) {
+	const uint32_t side = 20;
+	std::vector<Point3f> coords;
+	std::vector<Point3f> normals;
+	std::vector<uint32_t> index;
+	for(uint32_t y = 0; y < side; y++)
+		for(uint32_t x = 0; x < side; x++) {
+			coords.push_back(Point3f(x, y, 0.2f*sinf(x*0.7f)*cosf(y*0.5f)));
+			Point3f n(sinf(x*0.3f), cosf(y*0.4f), 1.0f);
+			normals.push_back(n/n.norm());
+		}
+	for(uint32_t y = 0; y + 1 < side; y++)
+		for(uint32_t x = 0; x + 1 < side; x++) {
+			uint32_t a = y*side + x;
+			uint32_t f[6] = { a, a + 1, a + side + 1, a, a + side + 1, a + side };
+			index.insert(index.end(), f, f + 6);
+		}
+	uint32_t fan = coords.size();
+	for(int i = 0; i < 5; i++) {
+		coords.push_back(Point3f(30, 30, 30));
+		normals.push_back(Point3f(0.6f, 0, -0.8f));
+	}
+	for(uint32_t i = 1; i < 4; i++) {
+		uint32_t f[3] = { fan, fan + i, fan + i + 1 };
+		index.insert(index.end(), f, f + 3);
+	}
+
+	Encoder encoder(coords.size(), index.size()/3);
+	encoder.addPositions((float *)coords.data(), index.data(), 0.01f);
+	encoder.addNormals((float *)normals.data(), 10, prediction);
+	encoder.encode();
+
+	uint32_t nvert = encoder.nvert;
+	std::vector<Point3f> decoded(nvert);
+	std::vector<Point2i> octa(nvert);
+	std::vector<uint32_t> faces(encoder.nface*3);
+	std::vector<Point3f> positions(nvert); //needed by the estimated normals.
+	{
+		Decoder decoder(encoder.stream.size(), encoder.stream.data());
+		decoder.setIndex(faces.data());
+		decoder.setPositions((float *)positions.data());
+		decoder.setNormals((float *)decoded.data());
+		decoder.decode();
+	}
+	Decoder decoder(encoder.stream.size(), encoder.stream.data());
+	decoder.setIndex(faces.data());
+	decoder.setPositions((float *)positions.data());
+	decoder.setNormals(octa.data(), VertexAttribute::OCTA32);
+	decoder.decode();
+	int unit = (int)lrintf(1.0f/decoder.data["normal"]->scale[0]);
+
+	int errors = 0;
+	for(uint32_t i = 0; i < nvert; i++) {
+		Point3f n = NormalAttr::toSphere(octa[i], unit);
+		if(!(fabs(n[0] - decoded[i][0]) < tolerance && fabs(n[1] - decoded[i][1]) < tolerance && fabs(n[2] - decoded[i][2]) < tolerance))
+			errors++;
+	}
+	if(errors)
+		fprintf(stderr, "%s: %d of %u OCTA32 normals differ from the float decode\n", name, errors, nvert);
+	return errors;
+}
+
+int main() {
+	int errors = check(NormalAttr::ESTIMATED, "estimated", 1e-5f);
+	errors += check(NormalAttr::BORDER, "border", 0.01f);
+	return errors? 1 : 0;
+}
@@ -0,0 +1,256 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <corto/simd.h>
+#include <corto/vertex_attribute.h>
+
+using namespace crt;
+
+//every kernel at every level available must write the same bytes as the scalar code,
+//the lengths are not multiples of the vector widths so the scalar tails run too.
+static const uint32_t lengths[] = { 0, 1, 3, 5, 7, 9, 15, 17, 31, 33, 63, 65, 1000, 1031 };
+
+static std::vector<Simd::Level> levels() {
+	std::vector<Simd::Level> l;
+	Simd::Level top = Simd::detect();
+	if(top == Simd::AVX2)
+		l.push_back(Simd::SSE2);
+	if(top != Simd::SCALAR)
+		l.push_back(top);
+	return l;
+}
+
+static const char *levelName(Simd::Level level) {
+	switch(level) {
+	case Simd::SSE2: return "sse2";
+	case Simd::AVX2: return "avx2";
+	case Simd::NEON: return "neon";
+	default: return "scalar";
+	}
+}
+
+static std::mt19937 rng(7);
+static int random(int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); }
+
+//run(out) writes the result of the kernel in out for the current Simd::level.
+template <class F> static int compare(const char *name, uint32_t n, F run) {
+	Simd::level = Simd::SCALAR;
+	std::vector<unsigned char> expected;
+	run(expected);
+	int errors = 0;
+	for(Simd::Level level: levels()) {
+		Simd::level = level;
+		std::vector<unsigned char> result;
+		run(result);
+		if(result != expected) {
+			fprintf(stderr, "%s: %s differs from scalar with n = %u\n", name, levelName(level), n);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+template <class T> static void bytes(const std::vector<T> &v, std::vector<unsigned char> &out) {
+	out.resize(v.size()*sizeof(T));
+	if(v.size())
+		memcpy(out.data(), v.data(), out.size());
+}
+
+static int testScale(uint32_t n) {
+	std::vector<int32_t> in(n);
+	for(int32_t &v: in)
+		v = random(-(1<<24), 1<<24);
+	return compare("scale", n, [&](std::vector<unsigned char> &out) {
+		std::vector<float> result(n);
+		Simd::scale(in.data(), result.data(), n, 0.0371f);
+		bytes(result, out);
+	}) + compare("scale inplace", n, [&](std::vector<unsigned char> &out) {
+		std::vector<int32_t> values(in);
+		Simd::scale(values.data(), (float *)values.data(), n, 3.5f);
+		bytes(values, out);
+	});
+}
+
+static void randomColors(std::vector<unsigned char> &colors, uint32_t n) {
+	colors.resize(n*4);
+	for(unsigned char &c: colors)
+		c = (unsigned char)random(0, 255);
+}
+
+static int testToRGB(uint32_t n) {
+	std::vector<unsigned char> colors;
+	randomColors(colors, n);
+	int errors = 0;
+	const int qcs[][4] = { { 1, 1, 1, 1 }, { 4, 2, 4, 8 }, { 3, 5, 1, 7 } };
+	for(const int *qc: qcs)
+		errors += compare("toRGB", n, [&](std::vector<unsigned char> &out) {
+			out = colors;
+			Simd::toRGB(out.data(), n, qc);
+		});
+	return errors;
+}
+
+//the vector kernels handle power of 2 factors only, the others go through the scalar loop.
+static int testToYCC(uint32_t n) {
+	std::vector<unsigned char> colors;
+	randomColors(colors, n);
+	int errors = 0;
+	const int qcs[][4] = { { 1, 1, 1, 1 }, { 4, 2, 4, 8 }, { 256, 128, 1, 2 }, { 3, 5, 1, 7 } };
+	for(const int *qc: qcs)
+		errors += compare("toYCC", n, [&](std::vector<unsigned char> &out) {
+			out = colors;
+			Simd::toYCC(out.data(), n, qc);
+		});
+	return errors;
+}
+
+static int testToFloat(uint32_t n) {
+	std::vector<unsigned char> in(n);
+	for(unsigned char &c: in)
+		c = (unsigned char)random(0, 255);
+	return compare("toFloat", n, [&](std::vector<unsigned char> &out) {
+		std::vector<float> result(n);
+		Simd::toFloat(in.data(), result.data(), n);
+		bytes(result, out);
+	});
+}
+
+//octahedral pairs inside the square [-unit, unit], the corners and the origin included.
+static void randomOcta(std::vector<int32_t> &octa, uint32_t n, int unit) {
+	octa.resize(n*2);
+	const int fixed[] = { 0, 0, unit, 0, -unit, 0, 0, unit, 0, -unit, unit, unit, -unit, -unit };
+	for(uint32_t i = 0; i < n*2; i++)
+		octa[i] = i < sizeof(fixed)/sizeof(int)? fixed[i] : random(-unit, unit);
+}
+
+static int testToSphere(uint32_t n) {
+	int errors = 0;
+	for(int unit: { 511, 32767 }) {
+		std::vector<int32_t> octa;
+		randomOcta(octa, n, unit);
+		errors += compare("toSphere float", n, [&](std::vector<unsigned char> &out) {
+			std::vector<Point3f> normals(n);
+			Simd::toSphere(octa.data(), normals.data(), n, unit);
+			bytes(normals, out);
+		});
+		errors += compare("toSphere short", n, [&](std::vector<unsigned char> &out) {
+			std::vector<Point3s> normals(n);
+			Simd::toSphere(octa.data(), normals.data(), n, unit);
+			bytes(normals, out);
+		});
+	}
+	return errors;
+}
+
+//random directions of random length, plus the zero vector (degenerate estimated normals), signed zeros and axes.
+static int testToOcta(uint32_t n) {
+	std::vector<Point3f> normals(n);
+	const Point3f fixed[] = { Point3f(0, 0, 0), Point3f(-0.0f, -0.0f, -0.0f), Point3f(0, 0, -1), Point3f(-0.0f, 1, 0),
+							  Point3f(1, -0.0f, -0.0f), Point3f(0.5f, -0.5f, 0) };
+	for(uint32_t i = 0; i < n; i++) {
+		if(i < sizeof(fixed)/sizeof(Point3f))
+			normals[i] = fixed[i];
+		else
+			normals[i] = Point3f(random(-1000, 1000), random(-1000, 1000), random(-1000, 1000))*(random(1, 100)*0.013f);
+	}
+	int errors = 0;
+	for(int unit: { 511, 32767 })
+		errors += compare("toOcta", n, [&](std::vector<unsigned char> &out) {
+			std::vector<int32_t> octa(n*2);
+			Simd::toOcta(normals.data(), octa.data(), n, unit);
+			bytes(octa, out);
+		});
+	return errors;
+}
+
+//running sums of N = 1...6 components (the kernels handle up to 4), starting from a non zero row.
+static int testPrefixSum(uint32_t n) {
+	int errors = 0;
+	for(int N = 1; N <= 6; N++) {
+		std::vector<int32_t> values(n*N);
+		for(int32_t &v: values)
+			v = random(-5000, 5000);
+		std::vector<int32_t> start(N);
+		for(int32_t &v: start)
+			v = random(-100000, 100000);
+		errors += compare("prefixSum", n, [&](std::vector<unsigned char> &out) {
+			std::vector<int32_t> result(values);
+			std::vector<int32_t> sum(start);
+			Simd::prefixSum(result.data(), n, N, sum.data());
+			result.insert(result.end(), sum.begin(), sum.end());
+			bytes(result, out);
+		});
+	}
+	return errors;
+}
+
+//prefixSum of vertex_attribute.h splits the rows among threads (ranges of at least 1<<16 rows, blocks of 1024):
+//plain scan for every level and number of threads.
+static int testThreadedPrefixSum() {
+	int errors = 0;
+	const uint32_t sizes[] = { 1023, 1025, (1<<16) + 3, 3*(1<<16) + 1000 };
+	for(uint32_t n: sizes) {
+		for(int N = 1; N <= 6; N++) {
+			std::vector<int32_t> values(n*N);
+			for(int32_t &v: values)
+				v = random(-5000, 5000);
+			std::vector<int32_t> expected(values);
+			std::vector<int32_t> sum(N, 0);
+			for(uint32_t i = 0; i < n; i++)
+				for(int c = 0; c < N; c++)
+					expected[i*N + c] = sum[c] += expected[i*N + c];
+
+			std::vector<Simd::Level> all = levels();
+			all.push_back(Simd::SCALAR);
+			for(Simd::Level level: all) {
+				Simd::level = level;
+				for(int threads = 1; threads <= 4; threads++) {
+					std::vector<int32_t> result(values);
+					prefixSum(result.data(), n, N, threads);
+					if(result != expected) {
+						fprintf(stderr, "threaded prefixSum: %s with %d threads differs from the scan with n = %u, N = %d\n",
+								levelName(level), threads, n, N);
+						errors++;
+					}
+				}
+			}
+		}
+	}
+	return errors;
+}
+
+int main() {
+	int errors = 0;
+	for(uint32_t n: lengths) {
+		errors += testScale(n);
+		errors += testToRGB(n);
+		errors += testToYCC(n);
+		errors += testToFloat(n);
+		errors += testToSphere(n);
+		errors += testToOcta(n);
+		errors += testPrefixSum(n);
+	}
+	errors += testThreadedPrefixSum();
+	return errors? 1 : 0;
+}
@@ -0,0 +1,168 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <corto/tiles.h>
+
+using namespace crt;
+
+//TileDecoder must write the same bytes as a Decoder per selected tile, concatenated in order:
+//packed rows (stride 0) and an interleaved vertex buffer, all the tiles or a box, serial and threaded.
+
+struct Reference {
+	std::vector<Point3f> positions;
+	std::vector<char> normals;
+	std::vector<uchar> colors;
+	std::vector<float> weights;
+};
+
+static Reference decodeTiles(TileDecoder &tiled, OutStream &stream, VertexAttribute::Format normal_format, int color_components) {
+	Reference ref;
+	int normal_bytes = (normal_format == VertexAttribute::OCTA16? 2 : 3)*VertexAttribute::formatBytes(normal_format);
+	for(uint32_t t: tiled.selected) {
+		Tile &tile = tiled.tiles[t];
+		uint32_t start = ref.positions.size();
+		ref.positions.resize(start + tile.nvert);
+		ref.normals.resize((start + tile.nvert)*normal_bytes);
+		ref.colors.resize((start + tile.nvert)*color_components);
+		ref.weights.resize(start + tile.nvert);
+
+		Decoder decoder(tile.length, stream.data() + tile.offset);
+		decoder.setPositions((float *)&ref.positions[start]);
+		decoder.setNormals(&ref.normals[start*normal_bytes], normal_format);
+		decoder.setColors(&ref.colors[start*color_components], color_components);
+		decoder.setAttribute("weight", (char *)&ref.weights[start], VertexAttribute::FLOAT);
+		decoder.decode();
+	}
+	return ref;
+}
+
+static int fail(const char *test, const char *attribute, int threads) {
+	printf("%s, %d threads: %s differs from the Decoder output\n", test, threads, attribute);
+	return 1;
+}
+
+static int checkPacked(OutStream &stream, bool box, int threads) {
+	TileDecoder tiled(stream.size(), stream.data());
+	if(box)
+		tiled.select(Point3f(0, 0, 0), Point3f(0.4f, 0.7f, 1.0f));
+	Reference ref = decodeTiles(tiled, stream, VertexAttribute::OCTA16, 3);
+
+	uint32_t nvert = tiled.nvert;
+	std::vector<Point3f> positions(nvert);
+	std::vector<char> normals(nvert*4);
+	std::vector<uchar> colors(nvert*3);
+	std::vector<float> weights(nvert);
+	tiled.threads = threads;
+	tiled.setAttribute("position", (char *)positions.data(), VertexAttribute::FLOAT, 0);
+	tiled.setAttribute("normal", normals.data(), VertexAttribute::OCTA16, 0);
+	tiled.setColors(colors.data(), 3, 0, 0);
+	tiled.setAttribute("weight", (char *)weights.data(), VertexAttribute::FLOAT, 0);
+	tiled.decode();
+
+	const char *test = box? "packed, box" : "packed";
+	int errors = 0;
+	if(memcmp(positions.data(), ref.positions.data(), nvert*sizeof(Point3f)))
+		errors += fail(test, "position", threads);
+	if(normals != ref.normals)
+		errors += fail(test, "normal", threads);
+	if(colors != ref.colors)
+		errors += fail(test, "color", threads);
+	if(weights != ref.weights)
+		errors += fail(test, "weight", threads);
+	return errors;
+}
+
+struct Vertex {
+	Point3f position;
+	Point3f normal;
+	uchar color[4];
+	float weight;
+};
+
+static int checkInterleaved(OutStream &stream, bool box, int threads) {
+	TileDecoder tiled(stream.size(), stream.data());
+	if(box)
+		tiled.select(Point3f(0, 0, 0), Point3f(0.4f, 0.7f, 1.0f));
+	Reference ref = decodeTiles(tiled, stream, VertexAttribute::FLOAT, 4);
+
+	uint32_t nvert = tiled.nvert;
+	std::vector<Vertex> vertices(nvert);
+	char *base = (char *)vertices.data();
+	tiled.threads = threads;
+	tiled.setAttribute("position", base, VertexAttribute::FLOAT, sizeof(Vertex), offsetof(Vertex, position));
+	tiled.setAttribute("normal", base, VertexAttribute::FLOAT, sizeof(Vertex), offsetof(Vertex, normal));
+	tiled.setColors((uchar *)base, 4, sizeof(Vertex), offsetof(Vertex, color));
+	tiled.setAttribute("weight", base, VertexAttribute::FLOAT, sizeof(Vertex), offsetof(Vertex, weight));
+	tiled.decode();
+
+	const char *test = box? "interleaved, box" : "interleaved";
+	bool position = true, normal = true, color = true, weight = true;
+	for(uint32_t i = 0; i < nvert; i++) {
+		Vertex &v = vertices[i];
+		position = position && !memcmp(&v.position, &ref.positions[i], sizeof(Point3f));
+		normal = normal && !memcmp(&v.normal, &ref.normals[i*sizeof(Point3f)], sizeof(Point3f));
+		color = color && !memcmp(v.color, &ref.colors[i*4], 4);
+		weight = weight && v.weight == ref.weights[i];
+	}
+	return (position? 0 : fail(test, "position", threads)) + (normal? 0 : fail(test, "normal", threads)) +
+			(color? 0 : fail(test, "color", threads)) + (weight? 0 : fail(test, "weight", threads));
+}
+
+int main() {
+	const uint32_t nvert = 20000;
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Point3f> positions(nvert);
+	std::vector<Point3f> normals(nvert);
+	std::vector<uchar> colors(nvert*4);
+	std::vector<float> weights(nvert);
+	for(uint32_t i = 0; i < nvert; i++) {
+		positions[i] = Point3f(unit(rng), unit(rng), unit(rng));
+		Point3f n(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f);
+		normals[i] = n/n.norm();
+		for(int k = 0; k < 4; k++)
+			colors[i*4 + k] = (uchar)(rng() & 0xff);
+		weights[i] = unit(rng)*10.0f;
+	}
+
+	TileEncoder encoder(nvert, 2000);
+	encoder.addPositions((float *)positions.data(), 0.001f);
+	encoder.addNormals((float *)normals.data(), 10);
+	encoder.addColors(colors.data());
+	encoder.addAttribute("weight", (char *)weights.data(), VertexAttribute::FLOAT, 1, 0.01f);
+	encoder.encode();
+	if(encoder.tiles.size() < 2) {
+		printf("expected several tiles, got %d\n", (int)encoder.tiles.size());
+		return 1;
+	}
+
+	int errors = 0;
+	for(int threads: { 1, 3 })
+		for(bool box: { false, true }) {
+			errors += checkPacked(encoder.stream, box, threads);
+			errors += checkInterleaved(encoder.stream, box, threads);
+		}
+	return errors? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/*
+Corto
+
+Copyright(C) 2017 - Federico Ponchio
+ISTI - Italian National Research Council - Visual Computing Lab
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  You should have received
+a copy of the GNU General Public License along with Corto.
+If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <corto/zpoint.h>
+
+using namespace crt;
+
+//morton ordering of the point cloud encoder: magic numbers interleave and radix sort
+//against the old bit by bit loop and std::sort. The orders must match on unique keys.
+//usage: zpoint_bench [npoints] [threads]
+
+static uint64_t loopBits(uint64_t x, uint64_t y, uint64_t z, int levels) {
+	uint64_t bits = 0;
+	uint64_t l = 1;
+	for (int i = 0; i < levels; i++)
+		bits |= (x & l << i)<< (2*i) | (y & l << i) << (2*i + 1) | (z & l << i) << (2*i+2);
+	return bits;
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int bench(uint32_t n, int levels, int threads) {
+	std::mt19937 rng(n + levels);
+	std::uniform_int_distribution<uint32_t> coord(0, (1u << levels) - 1);
+	std::vector<uint32_t> coords(n*3);
+	for(uint32_t &c: coords)
+		c = coord(rng);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<ZPoint> old(n);
+	for(uint32_t i = 0; i < n; i++) {
+		old[i].bits = loopBits(coords[i*3], coords[i*3+1], coords[i*3+2], levels);
+		old[i].pos = i;
+	}
+	double old_keys = elapsed(start);
+	start = std::chrono::steady_clock::now();
+	std::sort(old.rbegin(), old.rend());
+	double old_sort = elapsed(start);
+
+	start = std::chrono::steady_clock::now();
+	std::vector<ZPoint> zpoints(n);
+	parallelFor(threads, n, [&](uint32_t first, uint32_t last) {
+		for(uint32_t i = first; i < last; i++)
+			zpoints[i] = ZPoint(coords[i*3], coords[i*3+1], coords[i*3+2], levels, i);
+	});
+	double new_keys = elapsed(start);
+	start = std::chrono::steady_clock::now();
+	radixSort(zpoints, threads);
+	double new_sort = elapsed(start);
+
+	//duplicated keys may be ordered differently by std::sort, compare only the keys and unique positions.
+	int errors = 0;
+	for(uint32_t i = 0; i < n && !errors; i++) {
+		bool unique = (i == 0 || old[i-1].bits != old[i].bits) && (i + 1 == n || old[i+1].bits != old[i].bits);
+		if(old[i].bits != zpoints[i].bits || (unique && old[i].pos != zpoints[i].pos)) {
+			printf("%u points, %d bits: orders differ at %u\n", n, levels, i);
+			errors++;
+		}
+	}
+	printf("%u points, %2d bits: keys %8.2f -> %8.2f ms, sort %8.2f -> %8.2f ms\n",
+		   n, levels, old_keys, new_keys, old_sort, new_sort);
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t n = argc > 1? (uint32_t)atoi(argv[1]) : 1000000;
+	int threads = argc > 2? atoi(argv[2]) : 1;
+	int errors = 0;
+	for(int levels: { 10, 14, 21 })
+		errors += bench(n, levels, threads);
+	return errors? 1 : 0;
+}